@@ -0,0 +1,15 @@
+#pragma once
+
+#define ZMK_OVERRIDE_MOCK_OP_SET 0
+#define ZMK_OVERRIDE_MOCK_OP_CLEAR 1
+#define ZMK_OVERRIDE_MOCK_OP_RELOAD 2
+
+#define ZMK_OVERRIDE_MOCK_SET(layer, pos, msec)                                                    \
+    (ZMK_OVERRIDE_MOCK_OP_SET + (layer << 4) + (pos << 8) + (msec << 16))
+#define ZMK_OVERRIDE_MOCK_CLEAR(layer, pos, msec)                                                  \
+    (ZMK_OVERRIDE_MOCK_OP_CLEAR + (layer << 4) + (pos << 8) + (msec << 16))
+#define ZMK_OVERRIDE_MOCK_RELOAD(msec) (ZMK_OVERRIDE_MOCK_OP_RELOAD + (msec << 16))
+#define ZMK_OVERRIDE_MOCK_OP(v) (v & 0x0F)
+#define ZMK_OVERRIDE_MOCK_LAYER(v) ((v >> 4) & 0x0F)
+#define ZMK_OVERRIDE_MOCK_POS(v) ((v >> 8) & 0xFF)
+#define ZMK_OVERRIDE_MOCK_MSEC(v) (v >> 16)
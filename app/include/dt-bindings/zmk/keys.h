@@ -3,6 +3,10 @@
 
 #define USAGE_KEYPAD 0x07
 #define USAGE_CONSUMER 0x0C
+#define USAGE_BUTTON 0x09
+
+/* Generic Desktop page, identifies the pointer report */
+#define USAGE_POINTER 0x01
 
 #define A 0x04
 #define B 0x05
@@ -138,6 +142,9 @@
 #define M_MUTE 0xE2
 #define M_VOLU 0xE9
 #define M_VOLD 0xEA
+#define M_MAIL 0x18A
+#define M_CALC 0x192
+#define M_SRCH 0x221
 
 #define MOD_LCTL (1 << 0x00)
 #define MOD_LSFT (1 << 0x01)
@@ -0,0 +1,25 @@
+#pragma once
+
+/* Pointer buttons, used with &mkp */
+
+#define MB1 0x01
+#define MB2 0x02
+#define MB3 0x03
+#define MB4 0x04
+#define MB5 0x05
+
+#define LCLK MB1
+#define RCLK MB2
+#define MCLK MB3
+
+/* Directions, used with &mmv and &msc. They can be combined, e.g. (MOVE_UP | MOVE_LEFT) */
+
+#define MOVE_UP (1 << 0)
+#define MOVE_DOWN (1 << 1)
+#define MOVE_LEFT (1 << 2)
+#define MOVE_RIGHT (1 << 3)
+
+#define SCRL_UP MOVE_UP
+#define SCRL_DOWN MOVE_DOWN
+#define SCRL_LEFT MOVE_LEFT
+#define SCRL_RIGHT MOVE_RIGHT
\ No newline at end of file
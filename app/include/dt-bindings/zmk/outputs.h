@@ -0,0 +1,10 @@
+/*
+ * Copyright (c) 2020 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#define OUT_AUTO 0
+#define OUT_USB 1
+#define OUT_BLE 2
+#define OUT_TOG 3
\ No newline at end of file
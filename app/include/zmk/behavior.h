@@ -6,8 +6,12 @@
 
 #pragma once
 
+#include <device.h>
+
 struct zmk_behavior_binding {
     char *behavior_dev;
+    // Resolved from behavior_dev once at init, so the key press path does no lookups by name.
+    struct device *behavior;
     u32_t param1;
     u32_t param2;
 };
\ No newline at end of file
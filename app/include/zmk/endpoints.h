@@ -9,4 +9,40 @@
 #include <zmk/keys.h>
 #include <zmk/hid.h>
 
+enum zmk_endpoint {
+    ZMK_ENDPOINT_USB,
+    ZMK_ENDPOINT_BLE,
+    ZMK_ENDPOINT_COUNT,
+};
+
+// Counters for the output queue of one endpoint, see CONFIG_ZMK_ENDPOINT_QUEUES.
+struct zmk_endpoint_stats {
+    u32_t depth;
+    u32_t max_depth;
+    u32_t sent;
+    u32_t failed;
+    u32_t dropped;
+    u32_t last_latency_us;
+    u32_t max_latency_us;
+};
+
 int zmk_endpoints_send_report(u8_t usage_report);
+
+// Reports are sent to a single endpoint: USB while a host has enumerated the device, BLE
+// otherwise, unless an endpoint was selected explicitly.
+int zmk_endpoints_select(enum zmk_endpoint endpoint);
+int zmk_endpoints_toggle();
+void zmk_endpoints_clear_selection();
+enum zmk_endpoint zmk_endpoints_selected();
+
+// Called by transports when they become (un)available, to re-evaluate the selected endpoint.
+void zmk_endpoints_transport_changed();
+
+// Makes sure a report still waiting to be sent, in an open batch or in the report scheduler,
+// reaches the host before the report changes again.
+int zmk_endpoints_flush_report(u8_t usage_page);
+
+void zmk_endpoints_batch_begin();
+int zmk_endpoints_batch_end();
+
+int zmk_endpoints_get_stats(enum zmk_endpoint endpoint, struct zmk_endpoint_stats *stats);
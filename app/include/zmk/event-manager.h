@@ -8,10 +8,33 @@
 
 #include <stddef.h>
 #include <kernel.h>
+#include <sys/slist.h>
 #include <zephyr/types.h>
 
+// Subscriptions are laid out sorted by event type, so the listeners for one
+// type form a contiguous range of the subscription section. The range is
+// filled in once at boot by the event manager.
+struct zmk_event_subscribers {
+    u8_t start;
+    u8_t len;
+};
+
+// Each event type allocates from its own fixed-size slab instead of the shared heap. The slab
+// holds CONFIG_ZMK_EVENT_POOL_SIZE events unless the event type sets its own pool size.
+struct zmk_event_pool {
+    struct k_mem_slab *slab;
+    u32_t high_water;
+    u32_t alloc_failures;
+};
+
 struct zmk_event_type {
     const char *name;
+    struct zmk_event_subscribers *subscribers;
+    struct zmk_event_pool *pool;
+    // Offsets of the u32_t key and bool state fields subscriptions can filter on, or 0 if
+    // the event type has no such field.
+    u8_t filter_key_offset;
+    u8_t filter_state_offset;
 };
 
 struct zmk_event_header {
@@ -25,11 +48,30 @@ struct zmk_event_header {
 typedef int (*zmk_listener_callback_t)(const struct zmk_event_header *eh);
 struct zmk_listener {
     zmk_listener_callback_t callback;
+    const char *name;
 };
 
+// Listeners for an event type are called in ascending priority order, and in link order
+// within a priority. Priorities are sorted by section name, so they must be two digits.
+#define ZMK_EV_PRIORITY_CAPTURE 10
+#define ZMK_EV_PRIORITY_OUTPUT 30
+#define ZMK_EV_PRIORITY_DEFAULT 50
+#define ZMK_EV_PRIORITY_COSMETIC 90
+
+#define ZMK_EV_FILTER_RELEASED BIT(0)
+#define ZMK_EV_FILTER_PRESSED BIT(1)
+#define ZMK_EV_FILTER_STATE_ANY (ZMK_EV_FILTER_RELEASED | ZMK_EV_FILTER_PRESSED)
+
+// Keys are matched by their value modulo 32, so a key filter may let through some keys
+// the listener does not care about, but never drops one it does.
+#define ZMK_EV_FILTER_KEY(key) BIT((key) % 32)
+#define ZMK_EV_FILTER_KEY_ANY 0xFFFFFFFF
+
 struct zmk_event_subscription {
     const struct zmk_event_type *event_type;
     const struct zmk_listener *listener;
+    u32_t key_mask;
+    u8_t state_mask;
 };
 
 #define ZMK_EVENT_DECLARE(event_type)                                                              \
@@ -38,14 +80,22 @@ struct zmk_event_subscription {
     struct event_type *cast_##event_type(const struct zmk_event_header *eh);                       \
     extern const struct zmk_event_type zmk_event_##event_type;
 
-#define ZMK_EVENT_IMPL(event_type)                                                                 \
-    const struct zmk_event_type zmk_event_##event_type = {.name = STRINGIFY(event_type)};          \
+#define _ZMK_EVENT_IMPL(event_type, pool_size, key_offset, state_offset)                           \
+    static struct zmk_event_subscribers zmk_event_subscribers_##event_type;                        \
+    K_MEM_SLAB_DEFINE(zmk_event_slab_##event_type, ROUND_UP(sizeof(struct event_type), 4),         \
+                      pool_size, 4);                                                               \
+    static struct zmk_event_pool zmk_event_pool_##event_type = {                                   \
+        .slab = &zmk_event_slab_##event_type};                                                     \
+    const struct zmk_event_type zmk_event_##event_type = {                                         \
+        .name = STRINGIFY(event_type),                                                             \
+        .subscribers = &zmk_event_subscribers_##event_type,                                        \
+        .pool = &zmk_event_pool_##event_type,                                                      \
+        .filter_key_offset = key_offset,                                                           \
+        .filter_state_offset = state_offset};                                                      \
     const struct zmk_event_type *zmk_event_ref_##event_type __used                                 \
         __attribute__((__section__(".event_type"))) = &zmk_event_##event_type;                     \
     struct event_type *new_##event_type() {                                                        \
-        struct event_type *ev = (struct event_type *)k_malloc(sizeof(struct event_type));          \
-        ev->header.event = &zmk_event_##event_type;                                                \
-        return ev;                                                                                 \
+        return (struct event_type *)zmk_event_manager_alloc(&zmk_event_##event_type);              \
     };                                                                                             \
     bool is_##event_type(const struct zmk_event_header *eh) {                                      \
         return eh->event == &zmk_event_##event_type;                                               \
@@ -54,14 +104,40 @@ struct zmk_event_subscription {
         return (struct event_type *)eh;                                                            \
     };
 
-#define ZMK_LISTENER(mod, cb) const struct zmk_listener zmk_listener_##mod = {.callback = cb};
+#define ZMK_EVENT_IMPL(event_type) _ZMK_EVENT_IMPL(event_type, CONFIG_ZMK_EVENT_POOL_SIZE, 0, 0)
+
+#define ZMK_EVENT_IMPL_FILTERABLE(event_type, key_field, state_field)                              \
+    ZMK_EVENT_IMPL_FILTERABLE_POOL(event_type, CONFIG_ZMK_EVENT_POOL_SIZE, key_field, state_field)
+
+// Event types that can be held for a while, like the ones hold-tap captures, need a larger pool
+// than the default.
+#define ZMK_EVENT_IMPL_FILTERABLE_POOL(event_type, pool_size, key_field, state_field)              \
+    BUILD_ASSERT(sizeof(((struct event_type *)0)->key_field) == sizeof(u32_t),                     \
+                 "Filter key field must be a u32_t");                                              \
+    BUILD_ASSERT(sizeof(((struct event_type *)0)->state_field) == sizeof(bool),                    \
+                 "Filter state field must be a bool");                                             \
+    _ZMK_EVENT_IMPL(event_type, pool_size, offsetof(struct event_type, key_field),                 \
+                    offsetof(struct event_type, state_field))
+
+#define ZMK_LISTENER(mod, cb)                                                                      \
+    const struct zmk_listener zmk_listener_##mod = {.callback = cb, .name = STRINGIFY(mod)};
 
 #define ZMK_SUBSCRIPTION(mod, ev_type)                                                             \
+    ZMK_SUBSCRIPTION_PRIORITY(mod, ev_type, ZMK_EV_PRIORITY_DEFAULT)
+
+#define ZMK_SUBSCRIPTION_PRIORITY(mod, ev_type, priority)                                          \
+    ZMK_SUBSCRIPTION_FILTERED(mod, ev_type, priority, ZMK_EV_FILTER_STATE_ANY,                     \
+                              ZMK_EV_FILTER_KEY_ANY)
+
+#define ZMK_SUBSCRIPTION_FILTERED(mod, ev_type, priority, states, keys)                            \
+    BUILD_ASSERT(sizeof(STRINGIFY(priority)) == 3, "Listener priority must be two digits");        \
     const Z_DECL_ALIGN(struct zmk_event_subscription)                                              \
-        _CONCAT(_CONCAT(zmk_event_sub_, mod), ev_type) __used                                      \
-        __attribute__((__section__(".event_subscription"))) = {                                    \
+        _CONCAT(_CONCAT(zmk_event_sub_, mod), ev_type) __used __attribute__((                      \
+            __section__(".event_subscription." STRINGIFY(ev_type) "." STRINGIFY(priority)))) = {   \
             .event_type = &zmk_event_##ev_type,                                                    \
             .listener = &zmk_listener_##mod,                                                       \
+            .key_mask = keys,                                                                      \
+            .state_mask = states,                                                                  \
     };
 
 #define ZMK_EVENT_RAISE(ev) zmk_event_manager_raise((struct zmk_event_header *)ev);
@@ -74,8 +150,39 @@ struct zmk_event_subscription {
 
 #define ZMK_EVENT_RELEASE(ev) zmk_event_manager_release((struct zmk_event_header *)ev);
 
+#if IS_ENABLED(CONFIG_ZMK_EVENT_MANAGER_DEFERRED)
+
+#define ZMK_EVENT_RAISE_DEFERRED(ev)                                                               \
+    zmk_event_manager_raise_deferred((struct zmk_event_header *)ev);
+
+#define ZMK_EVENT_RAISE_AT_DEFERRED(ev, mod)                                                       \
+    zmk_event_manager_raise_at_deferred((struct zmk_event_header *)ev, &zmk_listener_##mod);
+
+#else
+
+#define ZMK_EVENT_RAISE_DEFERRED(ev) ZMK_EVENT_RAISE(ev)
+#define ZMK_EVENT_RAISE_AT_DEFERRED(ev, mod) ZMK_EVENT_RAISE_AT(ev, mod)
+
+#endif /* IS_ENABLED(CONFIG_ZMK_EVENT_MANAGER_DEFERRED) */
+
+struct zmk_event_header *zmk_event_manager_alloc(const struct zmk_event_type *type);
+void zmk_event_manager_free(struct zmk_event_header *event);
+
 int zmk_event_manager_raise(struct zmk_event_header *event);
 int zmk_event_manager_raise_after(struct zmk_event_header *event,
                                   const struct zmk_listener *listener);
 int zmk_event_manager_raise_at(struct zmk_event_header *event, const struct zmk_listener *listener);
 int zmk_event_manager_release(struct zmk_event_header *event);
+int zmk_event_manager_raise_deferred(struct zmk_event_header *event);
+int zmk_event_manager_raise_at_deferred(struct zmk_event_header *event,
+                                        const struct zmk_listener *listener);
+
+// Called from the work item that dispatches deferred events, before the first and after the last
+// event of each drain pass, so e.g. the reports changed by the whole pass can be sent once.
+struct zmk_event_manager_drain_hooks {
+    void (*begin)();
+    void (*end)();
+    sys_snode_t node;
+};
+
+void zmk_event_manager_add_drain_hooks(struct zmk_event_manager_drain_hooks *hooks);
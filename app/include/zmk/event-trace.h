@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2020 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <zmk/event-manager.h>
+
+enum zmk_event_trace_op {
+    ZMK_EVENT_TRACE_RAISE,
+    ZMK_EVENT_TRACE_RELEASE,
+    ZMK_EVENT_TRACE_CALLBACK,
+    ZMK_EVENT_TRACE_HANDLED,
+    ZMK_EVENT_TRACE_CAPTURED,
+    ZMK_EVENT_TRACE_ERROR,
+};
+
+struct zmk_event_trace_entry {
+    u32_t timestamp;
+    u32_t duration;
+    const struct zmk_event_header *event;
+    const struct zmk_event_type *event_type;
+    const struct zmk_listener *listener;
+    u8_t op;
+};
+
+// Timestamps are hardware cycles, except on native_posix where simulated time does not
+// advance while code runs, so the host monotonic clock in nanoseconds is used instead.
+u32_t zmk_event_trace_timestamp();
+
+// The event is only recorded by address and type, since it may already be freed when an entry
+// for a listener that captured and released it is recorded.
+void zmk_event_trace_record(enum zmk_event_trace_op op, const struct zmk_event_header *event,
+                            const struct zmk_event_type *event_type,
+                            const struct zmk_listener *listener, u32_t timestamp, u32_t duration);
+
+void zmk_event_trace_dump();
@@ -0,0 +1,18 @@
+/*
+ * Copyright (c) 2020 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <zephyr.h>
+#include <zmk/event-manager.h>
+#include <zmk/endpoints.h>
+
+struct endpoint_selection_changed {
+    struct zmk_event_header header;
+    enum zmk_endpoint endpoint;
+};
+
+ZMK_EVENT_DECLARE(endpoint_selection_changed);
\ No newline at end of file
@@ -21,6 +21,9 @@ ZMK_EVENT_DECLARE(keycode_state_changed);
 inline struct keycode_state_changed *create_keycode_state_changed(u8_t usage_page, u32_t keycode,
                                                                   bool state) {
     struct keycode_state_changed *ev = new_keycode_state_changed();
+    if (ev == NULL) {
+        return NULL;
+    }
     ev->usage_page = usage_page;
     ev->keycode = keycode;
     ev->state = state;
@@ -0,0 +1,18 @@
+/*
+ * Copyright (c) 2020 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <zephyr.h>
+#include <zmk/event-manager.h>
+
+struct layer_state_changed {
+    struct zmk_event_header header;
+    u32_t layer;
+    bool state;
+};
+
+ZMK_EVENT_DECLARE(layer_state_changed);
\ No newline at end of file
@@ -21,6 +21,9 @@ ZMK_EVENT_DECLARE(modifiers_state_changed);
 inline struct modifiers_state_changed *create_modifiers_state_changed(zmk_mod_flags modifiers,
                                                                       bool state) {
     struct modifiers_state_changed *ev = new_modifiers_state_changed();
+    if (ev == NULL) {
+        return NULL;
+    }
     ev->modifiers = modifiers;
     ev->state = state;
 
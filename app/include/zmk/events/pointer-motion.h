@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2020 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <zephyr.h>
+#include <zmk/event-manager.h>
+
+struct pointer_motion {
+    struct zmk_event_header header;
+    s16_t x;
+    s16_t y;
+    s16_t wheel;
+    s16_t pan;
+};
+
+ZMK_EVENT_DECLARE(pointer_motion);
+
+inline struct pointer_motion *create_pointer_motion(s16_t x, s16_t y, s16_t wheel, s16_t pan) {
+    struct pointer_motion *ev = new_pointer_motion();
+    if (ev == NULL) {
+        return NULL;
+    }
+    ev->x = x;
+    ev->y = y;
+    ev->wheel = wheel;
+    ev->pan = pan;
+
+    return ev;
+}
\ No newline at end of file
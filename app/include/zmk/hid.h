@@ -15,7 +15,28 @@
 
 #define COLLECTION_REPORT 0x03
 
-#define ZMK_HID_MAX_KEYCODE GUI
+#ifndef COLLECTION_PHYSICAL
+#define COLLECTION_PHYSICAL 0x00
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_HID_REPORT_TYPE_HKRO)
+#define ZMK_HID_MAX_KEYCODE 0xFF
+#else
+#define ZMK_HID_MAX_KEYCODE CONFIG_ZMK_HID_KEYBOARD_NKRO_MAX_USAGE
+
+// The NKRO bitmap has one bit per usage from 0 up to the configured maximum, rounded up to
+// whole bytes so hosts get the smallest report that covers the range.
+#define ZMK_HID_KEYBOARD_NKRO_SIZE (ZMK_HID_MAX_KEYCODE / 8 + 1)
+#define ZMK_HID_KEYBOARD_NKRO_PADDING (ZMK_HID_KEYBOARD_NKRO_SIZE * 8 - (ZMK_HID_MAX_KEYCODE + 1))
+#endif
+
+#define ZMK_HID_BOOT_KEYS 6
+// Keypad usage reported in every boot report slot while too many keys are down.
+#define ZMK_HID_BOOT_ERROR_ROLLOVER 0x01
+
+#define ZMK_HID_MAX_CONSUMER_USAGE 0x0FFF
+
+#define ZMK_HID_POINTER_BUTTONS 5
 
 static const u8_t zmk_hid_report_desc[] = {
     /* USAGE_PAGE (Generic Desktop) */
@@ -56,6 +77,43 @@ static const u8_t zmk_hid_report_desc[] = {
     HID_MI_INPUT,
     0x02,
 
+#if IS_ENABLED(CONFIG_ZMK_HID_REPORT_TYPE_HKRO)
+    /* REPORT_SIZE (8) */
+    HID_GI_REPORT_SIZE,
+    0x08,
+    /* REPORT_COUNT (1) */
+    HID_GI_REPORT_COUNT,
+    0x01,
+    /* INPUT (Cnst,Var,Abs) */
+    HID_MI_INPUT,
+    0x03,
+
+    /* USAGE_PAGE (Keypad) */
+    HID_GI_USAGE_PAGE,
+    USAGE_GEN_DESKTOP_KEYPAD,
+    /* LOGICAL_MINIMUM (0) */
+    HID_GI_LOGICAL_MIN(1),
+    0x00,
+    /* LOGICAL_MAXIMUM (255) */
+    HID_GI_LOGICAL_MAX(2),
+    0xFF,
+    0x00,
+    /* USAGE_MINIMUM (Reserved) */
+    HID_LI_USAGE_MIN(1),
+    0x00,
+    /* USAGE_MAXIMUM (255) */
+    HID_LI_USAGE_MAX(1),
+    0xFF,
+    /* REPORT_SIZE (8) */
+    HID_GI_REPORT_SIZE,
+    0x08,
+    /* REPORT_COUNT (6) */
+    HID_GI_REPORT_COUNT,
+    ZMK_HID_BOOT_KEYS,
+    /* INPUT (Data,Ary,Abs) */
+    HID_MI_INPUT,
+    0x00,
+#else
     /* USAGE_PAGE (Keypad) */
     HID_GI_USAGE_PAGE,
     USAGE_GEN_DESKTOP_KEYPAD,
@@ -68,30 +126,33 @@ static const u8_t zmk_hid_report_desc[] = {
     /* USAGE_MINIMUM (Reserved) */
     HID_LI_USAGE_MIN(1),
     0x00,
-    /* USAGE_MAXIMUM (Keyboard Application) */
+    /* USAGE_MAXIMUM (Highest usage in the bitmap) */
     HID_LI_USAGE_MAX(1),
     ZMK_HID_MAX_KEYCODE,
-    /* REPORT_SIZE (8) */
+    /* REPORT_SIZE (1) */
     HID_GI_REPORT_SIZE,
     0x01,
-    /* REPORT_COUNT (6) */
+    /* REPORT_COUNT (One bit per usage) */
     HID_GI_REPORT_COUNT,
     ZMK_HID_MAX_KEYCODE + 1,
-    /* INPUT (Data,Ary,Abs) */
+    /* INPUT (Data,Var,Abs) */
     HID_MI_INPUT,
     0x02,
+#if ZMK_HID_KEYBOARD_NKRO_PADDING > 0
     /* USAGE_PAGE (Keypad) */
     HID_GI_USAGE_PAGE,
     USAGE_GEN_DESKTOP_KEYPAD,
-    /* REPORT_SIZE (8) */
+    /* REPORT_SIZE (Bits up to the next byte) */
     HID_GI_REPORT_SIZE,
-    0x02,
-    /* REPORT_COUNT (6) */
+    ZMK_HID_KEYBOARD_NKRO_PADDING,
+    /* REPORT_COUNT (1) */
     HID_GI_REPORT_COUNT,
     0x01,
     /* INPUT (Cnst,Var,Abs) */
     HID_MI_INPUT,
     0x03,
+#endif
+#endif
     /* END_COLLECTION */
     HID_MI_COLLECTION_END,
     /* USAGE_PAGE (Consumer) */
@@ -112,37 +173,149 @@ static const u8_t zmk_hid_report_desc[] = {
     /* LOGICAL_MINIMUM (0) */
     HID_GI_LOGICAL_MIN(1),
     0x00,
-    /* LOGICAL_MAXIMUM (1) */
-    HID_GI_LOGICAL_MAX(1),
+    /* LOGICAL_MAXIMUM (0x0FFF) */
+    HID_GI_LOGICAL_MAX(2),
     0xFF,
+    0x0F,
+    /* USAGE_MINIMUM (0) */
     HID_LI_USAGE_MIN(1),
     0x00,
-    /* USAGE_MAXIMUM (Keyboard Application) */
-    HID_LI_USAGE_MAX(1),
+    /* USAGE_MAXIMUM (0x0FFF) */
+    HID_LI_USAGE_MAX(2),
     0xFF,
+    0x0F,
+    /* REPORT_SIZE (16) */
+    HID_GI_REPORT_SIZE,
+    0x10,
+    /* REPORT_COUNT (Configured number of slots) */
+    HID_GI_REPORT_COUNT,
+    CONFIG_ZMK_HID_CONSUMER_REPORT_SIZE,
     /* INPUT (Data,Ary,Abs) */
+    HID_MI_INPUT,
+    0x00,
+    /* END COLLECTION */
+    HID_MI_COLLECTION_END,
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+    /* USAGE_PAGE (Generic Desktop) */
+    HID_GI_USAGE_PAGE,
+    USAGE_GEN_DESKTOP,
+    /* USAGE (Mouse) */
+    HID_LI_USAGE,
+    0x02,
+    /* COLLECTION (Application) */
+    HID_MI_COLLECTION,
+    COLLECTION_APPLICATION,
+    /* REPORT ID (3) */
+    HID_GI_REPORT_ID,
+    0x03,
+    /* USAGE (Pointer) */
+    HID_LI_USAGE,
+    0x01,
+    /* COLLECTION (Physical) */
+    HID_MI_COLLECTION,
+    COLLECTION_PHYSICAL,
+    /* USAGE_PAGE (Button) */
+    HID_GI_USAGE_PAGE,
+    USAGE_BUTTON,
+    /* USAGE_MINIMUM (Button 1) */
+    HID_LI_USAGE_MIN(1),
+    0x01,
+    /* USAGE_MAXIMUM (Button 5) */
+    HID_LI_USAGE_MAX(1),
+    ZMK_HID_POINTER_BUTTONS,
+    /* LOGICAL_MINIMUM (0) */
+    HID_GI_LOGICAL_MIN(1),
+    0x00,
+    /* LOGICAL_MAXIMUM (1) */
+    HID_GI_LOGICAL_MAX(1),
+    0x01,
+    /* REPORT_SIZE (1) */
+    HID_GI_REPORT_SIZE,
+    0x01,
+    /* REPORT_COUNT (5) */
+    HID_GI_REPORT_COUNT,
+    ZMK_HID_POINTER_BUTTONS,
+    /* INPUT (Data,Var,Abs) */
+    HID_MI_INPUT,
+    0x02,
+    /* REPORT_SIZE (3) */
+    HID_GI_REPORT_SIZE,
+    8 - ZMK_HID_POINTER_BUTTONS,
+    /* REPORT_COUNT (1) */
+    HID_GI_REPORT_COUNT,
+    0x01,
+    /* INPUT (Cnst,Var,Abs) */
+    HID_MI_INPUT,
+    0x03,
+    /* USAGE_PAGE (Generic Desktop) */
+    HID_GI_USAGE_PAGE,
+    USAGE_GEN_DESKTOP,
+    /* USAGE (X) */
+    HID_LI_USAGE,
+    0x30,
+    /* USAGE (Y) */
+    HID_LI_USAGE,
+    0x31,
+    /* USAGE (Wheel) */
+    HID_LI_USAGE,
+    0x38,
+    /* LOGICAL_MINIMUM (-127) */
+    HID_GI_LOGICAL_MIN(1),
+    0x81,
+    /* LOGICAL_MAXIMUM (127) */
+    HID_GI_LOGICAL_MAX(1),
+    0x7F,
     /* REPORT_SIZE (8) */
     HID_GI_REPORT_SIZE,
     0x08,
-    /* REPORT_COUNT (8) */
+    /* REPORT_COUNT (3) */
     HID_GI_REPORT_COUNT,
+    0x03,
+    /* INPUT (Data,Var,Rel) */
+    HID_MI_INPUT,
     0x06,
+    /* USAGE_PAGE (Consumer) */
+    HID_GI_USAGE_PAGE,
+    0x0C,
+    /* USAGE (AC Pan), with a two byte usage ID */
+    0x0A,
+    0x38,
+    0x02,
+    /* REPORT_COUNT (1) */
+    HID_GI_REPORT_COUNT,
+    0x01,
+    /* INPUT (Data,Var,Rel) */
     HID_MI_INPUT,
-    0x00,
+    0x06,
+    /* END COLLECTION */
+    HID_MI_COLLECTION_END,
     /* END COLLECTION */
     HID_MI_COLLECTION_END,
+#endif
 };
 
-// struct zmk_hid_boot_report
-// {
-//     u8_t modifiers;
-//     u8_t _unused;
-//     u8_t keys[6];
-// } __packed;
+// Protocol selected by the host, through SET_PROTOCOL on USB or the Protocol Mode
+// characteristic on BLE. Values match both specifications.
+enum zmk_hid_protocol {
+    ZMK_HID_PROTOCOL_BOOT = 0,
+    ZMK_HID_PROTOCOL_REPORT = 1,
+};
+
+// The fixed 8 byte report sent in boot protocol, without a report ID.
+struct zmk_hid_boot_report {
+    zmk_mod_flags modifiers;
+    u8_t _reserved;
+    u8_t keys[ZMK_HID_BOOT_KEYS];
+} __packed;
 
 struct zmk_hid_keypad_report_body {
     zmk_mod_flags modifiers;
-    u8_t keys[13];
+#if IS_ENABLED(CONFIG_ZMK_HID_REPORT_TYPE_HKRO)
+    u8_t _reserved;
+    u8_t keys[ZMK_HID_BOOT_KEYS];
+#else
+    u8_t keys[ZMK_HID_KEYBOARD_NKRO_SIZE];
+#endif
 } __packed;
 
 struct zmk_hid_keypad_report {
@@ -151,7 +324,7 @@ struct zmk_hid_keypad_report {
 } __packed;
 
 struct zmk_hid_consumer_report_body {
-    u8_t keys[6];
+    u16_t keys[CONFIG_ZMK_HID_CONSUMER_REPORT_SIZE];
 } __packed;
 
 struct zmk_hid_consumer_report {
@@ -159,6 +332,19 @@ struct zmk_hid_consumer_report {
     struct zmk_hid_consumer_report_body body;
 } __packed;
 
+struct zmk_hid_pointer_report_body {
+    u8_t buttons;
+    s8_t x;
+    s8_t y;
+    s8_t wheel;
+    s8_t pan;
+} __packed;
+
+struct zmk_hid_pointer_report {
+    u8_t report_id;
+    struct zmk_hid_pointer_report_body body;
+} __packed;
+
 int zmk_hid_register_mod(zmk_mod modifier);
 int zmk_hid_unregister_mod(zmk_mod modifier);
 int zmk_hid_register_mods(zmk_mod_flags modifiers);
@@ -169,5 +355,31 @@ int zmk_hid_keypad_release(zmk_key key);
 int zmk_hid_consumer_press(zmk_key key);
 int zmk_hid_consumer_release(zmk_key key);
 
+// Number of consumer presses left out of the report because every slot was in use.
+u32_t zmk_hid_get_consumer_overflow_count();
+
+// Buttons are numbered from 1, as on the HID button page.
+int zmk_hid_pointer_button_press(zmk_key button);
+int zmk_hid_pointer_button_release(zmk_key button);
+
+// Adds to the motion not yet reported. Any number of sources may call this between reports.
+void zmk_hid_pointer_move(s16_t x, s16_t y, s16_t wheel, s16_t pan);
+
+// Moves as much pending motion as one report can carry into the pointer report, and
+// returns whether motion is left over for a later report.
+bool zmk_hid_pointer_take_motion();
+
+// Adds the motion of an earlier pointer report that is being replaced before it was sent,
+// clamped to what one report can carry. The buttons of the later report are kept.
+void zmk_hid_pointer_report_merge(struct zmk_hid_pointer_report_body *report,
+                                  const struct zmk_hid_pointer_report_body *earlier);
+
 struct zmk_hid_keypad_report *zmk_hid_get_keypad_report();
 struct zmk_hid_consumer_report *zmk_hid_get_consumer_report();
+struct zmk_hid_pointer_report *zmk_hid_get_pointer_report();
+
+// Kept up to date alongside the keypad report, ready to send to hosts in boot protocol.
+struct zmk_hid_boot_report *zmk_hid_get_boot_report();
+
+// Changes whenever the report for the usage page changes.
+u32_t zmk_hid_get_report_generation(u8_t usage_page);
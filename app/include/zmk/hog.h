@@ -13,3 +13,7 @@ int zmk_hog_init();
 
 int zmk_hog_send_keypad_report(struct zmk_hid_keypad_report_body *body);
 int zmk_hog_send_consumer_report(struct zmk_hid_consumer_report_body *body);
+int zmk_hog_send_boot_report(struct zmk_hid_boot_report *report);
+int zmk_hog_send_pointer_report(struct zmk_hid_pointer_report_body *body);
+
+u8_t zmk_hog_get_protocol();
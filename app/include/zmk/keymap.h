@@ -10,5 +10,12 @@ bool zmk_keymap_layer_active(u8_t layer);
 int zmk_keymap_layer_activate(u8_t layer);
 int zmk_keymap_layer_deactivate(u8_t layer);
 int zmk_keymap_layer_toggle(u8_t layer);
+u8_t zmk_keymap_highest_layer_active();
 
 int zmk_keymap_position_state_changed(u32_t position, bool pressed);
+
+int zmk_keymap_override_binding(u8_t layer, u32_t position, const char *behavior_dev,
+                                u32_t param1, u32_t param2);
+int zmk_keymap_clear_override(u8_t layer, u32_t position);
+// Replaces the overrides in RAM with the ones saved in settings.
+int zmk_keymap_reload_overrides();
@@ -12,6 +12,18 @@
 #include <zmk/keys.h>
 #include <zmk/hid.h>
 
-int zmk_usb_hid_init();
+// Counters for reports sent while the host was suspended, see CONFIG_ZMK_USB_WAKEUP_QUEUE_SIZE.
+struct zmk_usb_hid_wakeup_stats {
+    u32_t wakeups;
+    u32_t dropped;
+    u32_t last_latency_us;
+    u32_t max_latency_us;
+};
 
-int zmk_usb_hid_send_report(u8_t *report, size_t len);
+int zmk_usb_hid_send_report(const u8_t *report, size_t len);
+
+u8_t zmk_usb_hid_get_protocol();
+
+bool zmk_usb_hid_is_ready();
+
+void zmk_usb_hid_get_wakeup_stats(struct zmk_usb_hid_wakeup_stats *stats);
@@ -26,6 +26,11 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 #define ZMK_BHV_HOLD_TAP_MAX_HELD 10
 #define ZMK_BHV_HOLD_TAP_MAX_CAPTURED_EVENTS 40
 
+// Captured events stay allocated until they are released, so the pool needs room for a full
+// capture buffer plus the events still being raised around it.
+BUILD_ASSERT(CONFIG_ZMK_EVENT_CAPTURED_POOL_SIZE >= ZMK_BHV_HOLD_TAP_MAX_CAPTURED_EVENTS + 8,
+             "CONFIG_ZMK_EVENT_CAPTURED_POOL_SIZE is too small for the hold-tap capture buffer");
+
 // increase if you have keyboard with more keys.
 #define ZMK_BHV_HOLD_TAP_POSITION_NOT_USED 9999
 
@@ -130,13 +135,18 @@ static void release_captured_events() {
     // mt2_up event is not captured but causes release of mt2 behavior
     // [k1_down, k1_up, null, null, null, ...]
     // now mt2 will start releasing it's own captured positions.
+    //
+    // With CONFIG_ZMK_EVENT_MANAGER_DEFERRED, raising an event only queues it, ahead of any
+    // events that were already waiting. The loop then empties the whole array before the first
+    // released event is handled, and a new hold-tap started by one of them captures the ones
+    // after it as they come out of the queue, in the same order as above.
     for (int i = 0; i < ZMK_BHV_HOLD_TAP_MAX_CAPTURED_EVENTS; i++) {
         const struct zmk_event_header *captured_event = captured_events[i];
         if (captured_event == NULL) {
             return;
         }
         captured_events[i] = NULL;
-        if (undecided_hold_tap != NULL) {
+        if (!IS_ENABLED(CONFIG_ZMK_EVENT_MANAGER_DEFERRED) && undecided_hold_tap != NULL) {
             k_msleep(10);
         }
         if (is_position_state_changed(captured_event)) {
@@ -150,7 +160,10 @@ static void release_captured_events() {
             LOG_DBG("Releasing mods changed event 0x%02X %s", modifier_event->keycode,
                     (modifier_event->state ? "pressed" : "released"));
         }
-        ZMK_EVENT_RAISE_AT(captured_event, behavior_hold_tap);
+        int ret = ZMK_EVENT_RAISE_AT_DEFERRED(captured_event, behavior_hold_tap);
+        if (ret < 0) {
+            LOG_ERR("Failed to release captured event: %d", ret);
+        }
     }
 }
 
@@ -283,14 +296,12 @@ static void decide_hold_tap(struct active_hold_tap *hold_tap, enum decision_mome
     struct zmk_behavior_binding *behavior;
     if (hold_tap->is_hold) {
         behavior = &hold_tap->config->behaviors->hold;
-        struct device *behavior_device = device_get_binding(behavior->behavior_dev);
-        behavior_keymap_binding_pressed(behavior_device, hold_tap->position, hold_tap->param_hold,
-                                        0);
+        behavior_keymap_binding_pressed(behavior->behavior, hold_tap->position,
+                                        hold_tap->param_hold, 0);
     } else {
         behavior = &hold_tap->config->behaviors->tap;
-        struct device *behavior_device = device_get_binding(behavior->behavior_dev);
-        behavior_keymap_binding_pressed(behavior_device, hold_tap->position, hold_tap->param_tap,
-                                        0);
+        behavior_keymap_binding_pressed(behavior->behavior, hold_tap->position,
+                                        hold_tap->param_tap, 0);
     }
     release_captured_events();
 }
@@ -336,14 +347,12 @@ static int on_hold_tap_binding_released(struct device *dev, u32_t position, u32_
     struct zmk_behavior_binding *behavior;
     if (hold_tap->is_hold) {
         behavior = &hold_tap->config->behaviors->hold;
-        struct device *behavior_device = device_get_binding(behavior->behavior_dev);
-        behavior_keymap_binding_released(behavior_device, hold_tap->position, hold_tap->param_hold,
-                                         0);
+        behavior_keymap_binding_released(behavior->behavior, hold_tap->position,
+                                         hold_tap->param_hold, 0);
     } else {
         behavior = &hold_tap->config->behaviors->tap;
-        struct device *behavior_device = device_get_binding(behavior->behavior_dev);
-        behavior_keymap_binding_released(behavior_device, hold_tap->position, hold_tap->param_tap,
-                                         0);
+        behavior_keymap_binding_released(behavior->behavior, hold_tap->position,
+                                         hold_tap->param_tap, 0);
     }
 
     if (work_cancel_result == -EINPROGRESS) {
@@ -397,6 +406,11 @@ static int position_state_changed_listener(const struct zmk_event_header *eh) {
     return ZMK_EV_EVENT_CAPTURED;
 }
 
+#define MOD_KEYS_FILTER                                                                            \
+    (ZMK_EV_FILTER_KEY(LCTL) | ZMK_EV_FILTER_KEY(LSFT) | ZMK_EV_FILTER_KEY(LALT) |                 \
+     ZMK_EV_FILTER_KEY(LGUI) | ZMK_EV_FILTER_KEY(RCTL) | ZMK_EV_FILTER_KEY(RSFT) |                 \
+     ZMK_EV_FILTER_KEY(RALT) | ZMK_EV_FILTER_KEY(RGUI))
+
 static bool is_mod(struct keycode_state_changed *ev) {
     return ev->usage_page == USAGE_KEYPAD && ev->keycode >= LCTL && ev->keycode <= RGUI;
 }
@@ -433,9 +447,10 @@ int behavior_hold_tap_listener(const struct zmk_event_header *eh) {
 }
 
 ZMK_LISTENER(behavior_hold_tap, behavior_hold_tap_listener);
-ZMK_SUBSCRIPTION(behavior_hold_tap, position_state_changed);
+ZMK_SUBSCRIPTION_PRIORITY(behavior_hold_tap, position_state_changed, ZMK_EV_PRIORITY_CAPTURE);
 // this should be modifiers_state_changed, but unfrotunately that's not implemented yet.
-ZMK_SUBSCRIPTION(behavior_hold_tap, keycode_state_changed);
+ZMK_SUBSCRIPTION_FILTERED(behavior_hold_tap, keycode_state_changed, ZMK_EV_PRIORITY_CAPTURE,
+                          ZMK_EV_FILTER_STATE_ANY, MOD_KEYS_FILTER);
 
 void behavior_hold_tap_timer_work_handler(struct k_work *item) {
     struct active_hold_tap *hold_tap = CONTAINER_OF(item, struct active_hold_tap, work);
@@ -449,6 +464,10 @@ void behavior_hold_tap_timer_work_handler(struct k_work *item) {
 
 static int behavior_hold_tap_init(struct device *dev) {
     static bool init_first_run = true;
+    const struct behavior_hold_tap_config *cfg = dev->config_info;
+
+    cfg->behaviors->hold.behavior = device_get_binding(cfg->behaviors->hold.behavior_dev);
+    cfg->behaviors->tap.behavior = device_get_binding(cfg->behaviors->tap.behavior_dev);
 
     if (init_first_run) {
         for (int i = 0; i < ZMK_BHV_HOLD_TAP_MAX_HELD; i++) {
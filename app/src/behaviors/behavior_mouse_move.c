@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2020 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#define DT_DRV_COMPAT zmk_behavior_mouse_move
+
+#include <device.h>
+#include <drivers/behavior.h>
+#include <logging/log.h>
+
+#include <dt-bindings/zmk/mouse.h>
+#include <zmk/event-manager.h>
+#include <zmk/events/pointer-motion.h>
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+// Indexes of the MOVE_ flag bits.
+enum { DIR_UP, DIR_DOWN, DIR_LEFT, DIR_RIGHT, DIRECTIONS };
+
+BUILD_ASSERT(MOVE_UP == BIT(DIR_UP) && MOVE_DOWN == BIT(DIR_DOWN) &&
+                 MOVE_LEFT == BIT(DIR_LEFT) && MOVE_RIGHT == BIT(DIR_RIGHT),
+             "Direction flags must match their indexes");
+
+// Speeds and distances are kept in 16.16 fixed point between ticks.
+#define FIXED_SHIFT 16
+#define FIXED_ONE (1 << FIXED_SHIFT)
+
+struct behavior_mouse_move_config {
+    bool scroll;
+    // Counts per second when a direction is first pressed, and after acceleration_ms.
+    u16_t initial_speed;
+    u16_t max_speed;
+    u16_t acceleration_ms;
+    u8_t acceleration_exponent;
+};
+
+struct behavior_mouse_move_data {
+    const struct behavior_mouse_move_config *config;
+    // Number of held bindings moving in each direction.
+    u8_t pressed[DIRECTIONS];
+    // When the instance started moving, and when it last took a step.
+    s64_t start_time;
+    s64_t last_move_time;
+    // Movement not yet reported, in fixed point counts.
+    s32_t remainder_x;
+    s32_t remainder_y;
+};
+
+// A tick that runs late moves at most this far, which keeps a step at the highest speed within
+// the 16.16 remainders and its counts within the 16-bit report fields.
+#define MAX_TICK_ELAPSED_MS 250
+
+// One tick moves every held instance, and the combined motion is raised as a single event.
+static struct k_delayed_work mouse_tick_work;
+static bool mouse_tick_running;
+
+static void mouse_tick(struct k_work *work);
+
+static bool is_moving(const struct behavior_mouse_move_data *data) {
+    for (int i = 0; i < DIRECTIONS; i++) {
+        if (data->pressed[i] > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Speed in counts per second, after moving for the given number of milliseconds. The
+// acceleration follows (elapsed / acceleration_ms) ^ acceleration_exponent.
+static u32_t current_speed(const struct behavior_mouse_move_config *cfg, s64_t elapsed) {
+    u32_t progress = FIXED_ONE;
+    u32_t factor = FIXED_ONE;
+
+    if (elapsed < cfg->acceleration_ms) {
+        progress = (u32_t)((elapsed << FIXED_SHIFT) / cfg->acceleration_ms);
+    }
+
+    for (int i = 0; i < cfg->acceleration_exponent; i++) {
+        factor = ((u64_t)factor * progress) >> FIXED_SHIFT;
+    }
+
+    if (cfg->max_speed <= cfg->initial_speed) {
+        return cfg->initial_speed;
+    }
+
+    return cfg->initial_speed +
+           (((u64_t)(cfg->max_speed - cfg->initial_speed) * factor) >> FIXED_SHIFT);
+}
+
+// Takes the whole counts out of a fixed point remainder, rounding towards zero.
+static s16_t take_counts(s32_t *remainder) {
+    s32_t counts = *remainder / FIXED_ONE;
+
+    *remainder -= counts * FIXED_ONE;
+    return counts;
+}
+
+static void move_instance(struct behavior_mouse_move_data *data, s64_t now, u32_t elapsed_ms,
+                          bool first_step, s16_t *x, s16_t *y, s16_t *wheel, s16_t *pan) {
+    int dx = (data->pressed[DIR_RIGHT] > 0) - (data->pressed[DIR_LEFT] > 0);
+    int dy = (data->pressed[DIR_DOWN] > 0) - (data->pressed[DIR_UP] > 0);
+    s16_t counts_x, counts_y;
+    s32_t step = ((s64_t)current_speed(data->config, now - data->start_time) * FIXED_ONE *
+                  MIN(elapsed_ms, MAX_TICK_ELAPSED_MS)) /
+                 1000;
+
+    // The first step is taken on press and moves at least one count, so a tap released before
+    // the next tick still moves, even at speeds below one count per tick.
+    if (first_step) {
+        step = MAX(step, FIXED_ONE);
+    }
+
+    data->remainder_x += dx * step;
+    data->remainder_y += dy * step;
+
+    counts_x = take_counts(&data->remainder_x);
+    counts_y = take_counts(&data->remainder_y);
+
+    data->last_move_time = now;
+
+    if (data->config->scroll) {
+        // The wheel counts up for scrolling away from the user.
+        *wheel -= counts_y;
+        *pan += counts_x;
+    } else {
+        *x += counts_x;
+        *y += counts_y;
+    }
+}
+
+static void raise_motion(s16_t x, s16_t y, s16_t wheel, s16_t pan) {
+    if (x != 0 || y != 0 || wheel != 0 || pan != 0) {
+        ZMK_EVENT_RAISE(create_pointer_motion(x, y, wheel, pan));
+    }
+}
+
+static int behavior_mouse_move_init(struct device *dev) {
+    static bool init_first_run = true;
+
+    if (init_first_run) {
+        k_delayed_work_init(&mouse_tick_work, mouse_tick);
+    }
+    init_first_run = false;
+    return 0;
+};
+
+static int on_keymap_binding_pressed(struct device *dev, u32_t position, u32_t directions,
+                                     u32_t _) {
+    struct behavior_mouse_move_data *data = dev->driver_data;
+    s64_t now = k_uptime_get();
+    bool starting = !is_moving(data);
+    LOG_DBG("position %d directions 0x%02X", position, directions);
+
+    if (directions == 0 || directions >= BIT(DIRECTIONS)) {
+        return -EINVAL;
+    }
+
+    if (starting) {
+        data->start_time = now;
+        data->remainder_x = 0;
+        data->remainder_y = 0;
+    }
+
+    for (int i = 0; i < DIRECTIONS; i++) {
+        if (directions & BIT(i)) {
+            data->pressed[i]++;
+        }
+    }
+
+    // The first step moves as far as one whole tick would, and the ticks take over from there.
+    if (starting) {
+        s16_t x = 0, y = 0, wheel = 0, pan = 0;
+
+        move_instance(data, now, CONFIG_ZMK_MOUSE_KEYS_TICK_MS, true, &x, &y, &wheel, &pan);
+        raise_motion(x, y, wheel, pan);
+    }
+
+    if (!mouse_tick_running) {
+        mouse_tick_running = true;
+        k_delayed_work_submit(&mouse_tick_work, K_MSEC(CONFIG_ZMK_MOUSE_KEYS_TICK_MS));
+    }
+
+    return 0;
+}
+
+static int on_keymap_binding_released(struct device *dev, u32_t position, u32_t directions,
+                                      u32_t _) {
+    struct behavior_mouse_move_data *data = dev->driver_data;
+    LOG_DBG("position %d directions 0x%02X", position, directions);
+
+    for (int i = 0; i < DIRECTIONS; i++) {
+        if ((directions & BIT(i)) && data->pressed[i] > 0) {
+            data->pressed[i]--;
+        }
+    }
+
+    return 0;
+}
+
+static const struct behavior_driver_api behavior_mouse_move_driver_api = {
+    .binding_pressed = on_keymap_binding_pressed, .binding_released = on_keymap_binding_released};
+
+#define MM_INST(n)                                                                                 \
+    static const struct behavior_mouse_move_config behavior_mouse_move_config_##n = {              \
+        .scroll = DT_INST_PROP(n, scroll),                                                         \
+        .initial_speed = DT_INST_PROP(n, initial_speed),                                           \
+        .max_speed = DT_INST_PROP(n, max_speed),                                                   \
+        .acceleration_ms = DT_INST_PROP(n, acceleration_ms),                                       \
+        .acceleration_exponent = DT_INST_PROP(n, acceleration_exponent)};                          \
+    static struct behavior_mouse_move_data behavior_mouse_move_data_##n = {                        \
+        .config = &behavior_mouse_move_config_##n};                                                \
+    DEVICE_AND_API_INIT(behavior_mouse_move_##n, DT_INST_LABEL(n), behavior_mouse_move_init,       \
+                        &behavior_mouse_move_data_##n, &behavior_mouse_move_config_##n,            \
+                        APPLICATION, CONFIG_KERNEL_INIT_PRIORITY_DEFAULT,                          \
+                        &behavior_mouse_move_driver_api);
+
+DT_INST_FOREACH_STATUS_OKAY(MM_INST)
+
+#define MM_DATA_REF(n) &behavior_mouse_move_data_##n,
+
+static struct behavior_mouse_move_data *const mouse_move_instances[] = {
+    DT_INST_FOREACH_STATUS_OKAY(MM_DATA_REF)};
+
+static void mouse_tick(struct k_work *work) {
+    s64_t now = k_uptime_get();
+    s16_t x = 0, y = 0, wheel = 0, pan = 0;
+    bool active = false;
+
+    for (int i = 0; i < ARRAY_SIZE(mouse_move_instances); i++) {
+        struct behavior_mouse_move_data *data = mouse_move_instances[i];
+
+        if (!is_moving(data)) {
+            continue;
+        }
+
+        active = true;
+        move_instance(data, now, now - data->last_move_time, false, &x, &y, &wheel, &pan);
+    }
+
+    raise_motion(x, y, wheel, pan);
+
+    if (active) {
+        k_delayed_work_submit(&mouse_tick_work, K_MSEC(CONFIG_ZMK_MOUSE_KEYS_TICK_MS));
+    } else {
+        mouse_tick_running = false;
+    }
+}
\ No newline at end of file
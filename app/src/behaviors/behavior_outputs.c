@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2020 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#define DT_DRV_COMPAT zmk_behavior_outputs
+
+#include <device.h>
+#include <drivers/behavior.h>
+
+#include <dt-bindings/zmk/outputs.h>
+
+#include <logging/log.h>
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#include <zmk/endpoints.h>
+
+static int on_keymap_binding_pressed(struct device *dev, u32_t position, u32_t command, u32_t _) {
+    switch (command) {
+    case OUT_AUTO:
+        zmk_endpoints_clear_selection();
+        return 0;
+    case OUT_USB:
+        return zmk_endpoints_select(ZMK_ENDPOINT_USB);
+    case OUT_BLE:
+        return zmk_endpoints_select(ZMK_ENDPOINT_BLE);
+    case OUT_TOG:
+        return zmk_endpoints_toggle();
+    default:
+        LOG_ERR("Unknown output command: %d", command);
+    }
+
+    return -ENOTSUP;
+}
+
+static int behavior_outputs_init(struct device *dev) { return 0; };
+
+static int on_keymap_binding_released(struct device *dev, u32_t position, u32_t command,
+                                      u32_t _) {
+    return 0;
+}
+
+static const struct behavior_driver_api behavior_outputs_driver_api = {
+    .binding_pressed = on_keymap_binding_pressed,
+    .binding_released = on_keymap_binding_released,
+};
+
+DEVICE_AND_API_INIT(behavior_outputs, DT_INST_LABEL(0), behavior_outputs_init, NULL, NULL,
+                    APPLICATION, CONFIG_KERNEL_INIT_PRIORITY_DEFAULT, &behavior_outputs_driver_api);
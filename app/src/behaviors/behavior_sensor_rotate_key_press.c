@@ -53,19 +53,16 @@ static int on_sensor_binding_triggered(struct device *dev, struct device *sensor
 
     LOG_DBG("SEND %d", keycode);
 
-    ev = new_keycode_state_changed();
-    ev->usage_page = cfg->usage_page;
-    ev->keycode = keycode;
-    ev->state = true;
+    ev = create_keycode_state_changed(cfg->usage_page, keycode, true);
+    if (ev == NULL) {
+        return -ENOMEM;
+    }
     ZMK_EVENT_RAISE(ev);
 
     // TODO: Better way to do this?
     k_msleep(5);
 
-    ev = new_keycode_state_changed();
-    ev->usage_page = cfg->usage_page;
-    ev->keycode = keycode;
-    ev->state = false;
+    ev = create_keycode_state_changed(cfg->usage_page, keycode, false);
     return ZMK_EVENT_RAISE(ev);
 }
 
@@ -69,6 +69,9 @@ static bt_addr_le_t peripheral_addr;
 
 static void raise_profile_changed_event() {
     struct ble_active_profile_changed *ev = new_ble_active_profile_changed();
+    if (ev == NULL) {
+        return;
+    }
     ev->index = active_profile;
     ev->profile = &profiles[active_profile];
 
@@ -23,6 +23,9 @@ static u8_t combo_state;
 const u32_t key_positions[] = DT_INST_PROP(0, key_positions);
 #define KP_LEN DT_INST_PROP_LEN(0, key_positions)
 
+#define KP_FILTER_KEY(idx, _) ZMK_EV_FILTER_KEY(DT_INST_PROP_BY_IDX(0, key_positions, idx)) |
+#define KP_FILTER_KEYS (UTIL_LISTIFY(KP_LEN, KP_FILTER_KEY, _) 0)
+
 int index_for_key_position(u32_t kp) {
     for (int i = 0; i < KP_LEN; i++) {
         if (key_positions[i] == kp) {
@@ -69,7 +72,8 @@ int zmk_ble_unpair_combo_init(struct device *_unused) {
 };
 
 ZMK_LISTENER(zmk_ble_unpair_combo, unpair_combo_listener);
-ZMK_SUBSCRIPTION(zmk_ble_unpair_combo, position_state_changed);
+ZMK_SUBSCRIPTION_FILTERED(zmk_ble_unpair_combo, position_state_changed, ZMK_EV_PRIORITY_DEFAULT,
+                          ZMK_EV_FILTER_STATE_ANY, KP_FILTER_KEYS);
 
 SYS_INIT(zmk_ble_unpair_combo_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
 
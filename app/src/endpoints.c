@@ -4,58 +4,859 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <string.h>
+#include <init.h>
+
 #include <zmk/endpoints.h>
 #include <zmk/hid.h>
 #include <zmk/usb_hid.h>
 #include <zmk/hog.h>
+#include <zmk/event-manager.h>
+#include <zmk/events/endpoint-selection-changed.h>
 
 #include <logging/log.h>
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
-int zmk_endpoints_send_report(u8_t usage_page) {
-    int err;
-    struct zmk_hid_keypad_report *keypad_report;
-    struct zmk_hid_consumer_report *consumer_report;
-    LOG_DBG("usage page 0x%02X", usage_page);
+#define PENDING_KEYPAD BIT(0)
+#define PENDING_CONSUMER BIT(1)
+#define PENDING_POINTER BIT(2)
+
+// While a batch is open, reports are only marked pending and are sent once when the
+// outermost batch ends, so e.g. a chord scanned in one pass produces a single report. A batch
+// belongs to the thread that opened it, reports sent from other threads go out right away.
+static struct k_spinlock batch_lock;
+static k_tid_t batch_thread;
+static u8_t batch_depth;
+static u8_t pending_reports;
+
+// Generation of each report as last sent successfully, see zmk_hid_get_report_generation.
+static u32_t sent_keypad_generation;
+static u32_t sent_consumer_generation;
+static u32_t sent_pointer_generation;
+
+// Reports only go to this endpoint. Until USB is enumerated, a board with both transports
+// sends over BLE.
+static enum zmk_endpoint selected_endpoint =
+    IS_ENABLED(CONFIG_ZMK_BLE) ? ZMK_ENDPOINT_BLE : ZMK_ENDPOINT_USB;
+static bool endpoint_overridden;
+static enum zmk_endpoint endpoint_override;
+
+// A copy of one report as it stood at some point, so it can be sent later.
+struct endpoint_report {
+    u8_t usage_page;
+    u32_t generation;
+    union {
+        // Both layouts are kept, so each transport can send the one its host's protocol uses.
+        struct {
+            struct zmk_hid_keypad_report report;
+            struct zmk_hid_boot_report boot;
+        } keypad;
+        struct zmk_hid_consumer_report consumer;
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+        struct zmk_hid_pointer_report pointer;
+#endif
+    };
+};
+
+static u8_t pending_flag(u8_t usage_page) {
     switch (usage_page) {
     case USAGE_KEYPAD:
-        keypad_report = zmk_hid_get_keypad_report();
+        return PENDING_KEYPAD;
+    case USAGE_CONSUMER:
+        return PENDING_CONSUMER;
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+    case USAGE_POINTER:
+        return PENDING_POINTER;
+#endif
+    default:
+        return 0;
+    }
+}
+
+static u32_t *sent_generation(u8_t usage_page) {
+    switch (usage_page) {
+    case USAGE_KEYPAD:
+        return &sent_keypad_generation;
+    case USAGE_CONSUMER:
+        return &sent_consumer_generation;
+    case USAGE_POINTER:
+        return &sent_pointer_generation;
+    default:
+        return NULL;
+    }
+}
+
+static int capture_report(u8_t usage_page, struct endpoint_report *report) {
+    report->usage_page = usage_page;
+    report->generation = zmk_hid_get_report_generation(usage_page);
+
+    switch (usage_page) {
+    case USAGE_KEYPAD:
+        report->keypad.report = *zmk_hid_get_keypad_report();
+        report->keypad.boot = *zmk_hid_get_boot_report();
+        return 0;
+    case USAGE_CONSUMER:
+        report->consumer = *zmk_hid_get_consumer_report();
+        return 0;
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+    case USAGE_POINTER:
+        // Pointer motion accumulates in the HID layer until a report is captured.
+        zmk_hid_pointer_take_motion();
+        report->pointer = *zmk_hid_get_pointer_report();
+        return 0;
+#endif
+    default:
+        LOG_ERR("Unsupported usage page %d", usage_page);
+        return -ENOTSUP;
+    }
+}
+
 #ifdef CONFIG_ZMK_USB
-        if (zmk_usb_hid_send_report((u8_t *)keypad_report, sizeof(struct zmk_hid_keypad_report)) !=
-            0) {
-            LOG_DBG("USB Send Failed");
+static int send_usb_report(struct endpoint_report *report) {
+    switch (report->usage_page) {
+    case USAGE_KEYPAD:
+        if (zmk_usb_hid_get_protocol() == ZMK_HID_PROTOCOL_BOOT) {
+            return zmk_usb_hid_send_report((u8_t *)&report->keypad.boot,
+                                           sizeof(struct zmk_hid_boot_report));
+        }
+        return zmk_usb_hid_send_report((u8_t *)&report->keypad.report,
+                                       sizeof(struct zmk_hid_keypad_report));
+    case USAGE_CONSUMER:
+        // Hosts in boot protocol only expect the boot keyboard report.
+        if (zmk_usb_hid_get_protocol() == ZMK_HID_PROTOCOL_BOOT) {
+            return 0;
         }
+        return zmk_usb_hid_send_report((u8_t *)&report->consumer,
+                                       sizeof(struct zmk_hid_consumer_report));
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+    case USAGE_POINTER:
+        if (zmk_usb_hid_get_protocol() == ZMK_HID_PROTOCOL_BOOT) {
+            return 0;
+        }
+        return zmk_usb_hid_send_report((u8_t *)&report->pointer,
+                                       sizeof(struct zmk_hid_pointer_report));
+#endif
+    default:
+        return -ENOTSUP;
+    }
+}
 #endif /* CONFIG_ZMK_USB */
 
 #ifdef CONFIG_ZMK_BLE
-        err = zmk_hog_send_keypad_report(&keypad_report->body);
-        if (err) {
-            LOG_ERR("FAILED TO SEND OVER HOG: %d", err);
+static int send_hog_report(struct endpoint_report *report) {
+    switch (report->usage_page) {
+    case USAGE_KEYPAD:
+        if (zmk_hog_get_protocol() == ZMK_HID_PROTOCOL_BOOT) {
+            return zmk_hog_send_boot_report(&report->keypad.boot);
+        }
+        return zmk_hog_send_keypad_report(&report->keypad.report.body);
+    case USAGE_CONSUMER:
+        // Hosts in boot protocol only expect the boot keyboard report.
+        if (zmk_hog_get_protocol() == ZMK_HID_PROTOCOL_BOOT) {
+            return 0;
         }
+        return zmk_hog_send_consumer_report(&report->consumer.body);
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+    case USAGE_POINTER:
+        if (zmk_hog_get_protocol() == ZMK_HID_PROTOCOL_BOOT) {
+            return 0;
+        }
+        return zmk_hog_send_pointer_report(&report->pointer.body);
+#endif
+    default:
+        return -ENOTSUP;
+    }
+}
 #endif /* CONFIG_ZMK_BLE */
 
+#if IS_ENABLED(CONFIG_ZMK_ENDPOINTS_MOCK)
+
+// Stands in for both transports in tests, logging the body of each report sent.
+static int send_mock_report(const char *name, struct endpoint_report *report) {
+    char hex[2 * sizeof(struct endpoint_report) + 1] = "";
+    const u8_t *body;
+    size_t len;
+
+    switch (report->usage_page) {
+    case USAGE_KEYPAD:
+        body = (const u8_t *)&report->keypad.report.body;
+        len = sizeof(report->keypad.report.body);
         break;
     case USAGE_CONSUMER:
-        consumer_report = zmk_hid_get_consumer_report();
+        body = (const u8_t *)&report->consumer.body;
+        len = sizeof(report->consumer.body);
+        break;
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+    case USAGE_POINTER:
+        body = (const u8_t *)&report->pointer.body;
+        len = sizeof(report->pointer.body);
+        break;
+#endif
+    default:
+        return -ENOTSUP;
+    }
+
+    for (int i = 0; i < len; i++) {
+        snprintf(&hex[i * 2], 3, "%02x", body[i]);
+    }
+
+    LOG_DBG("%s usage page 0x%02X: %s", name, report->usage_page, log_strdup(hex));
+    return 0;
+}
+
+static int send_mock_usb_report(struct endpoint_report *report) {
+    return send_mock_report("USB", report);
+}
+
+static int send_mock_hog_report(struct endpoint_report *report) {
+    return send_mock_report("HOG", report);
+}
+
+#endif /* IS_ENABLED(CONFIG_ZMK_ENDPOINTS_MOCK) */
+
+struct endpoint {
+    const char *name;
+    int (*send)(struct endpoint_report *report);
+#if IS_ENABLED(CONFIG_ZMK_ENDPOINT_QUEUES)
+    struct k_msgq *queue;
+    struct zmk_endpoint_stats stats;
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+    // Motion of pointer reports dropped from the queue, added to the next one sent.
+    struct zmk_hid_pointer_report_body dropped_motion;
+#endif
+#endif
+};
+
+#if IS_ENABLED(CONFIG_ZMK_ENDPOINT_QUEUES)
+
+struct queued_report {
+    u32_t enqueued_cycles;
+    struct endpoint_report report;
+};
+
+static struct k_spinlock dropped_motion_lock;
+
 #ifdef CONFIG_ZMK_USB
-        if (zmk_usb_hid_send_report((u8_t *)consumer_report,
-                                    sizeof(struct zmk_hid_consumer_report)) != 0) {
-            LOG_DBG("USB Send Failed");
-        }
-#endif /* CONFIG_ZMK_USB */
+K_MSGQ_DEFINE(usb_report_queue, sizeof(struct queued_report), CONFIG_ZMK_ENDPOINT_QUEUE_SIZE, 4);
+#endif
+
+#ifdef CONFIG_ZMK_BLE
+K_MSGQ_DEFINE(hog_report_queue, sizeof(struct queued_report), CONFIG_ZMK_ENDPOINT_QUEUE_SIZE, 4);
+#endif
+
+#endif /* IS_ENABLED(CONFIG_ZMK_ENDPOINT_QUEUES) */
 
+// Entries for disabled transports are left empty.
+static struct endpoint endpoints[ZMK_ENDPOINT_COUNT] = {
+#if IS_ENABLED(CONFIG_ZMK_ENDPOINTS_MOCK)
+    [ZMK_ENDPOINT_USB] = {.name = "USB", .send = send_mock_usb_report},
+    [ZMK_ENDPOINT_BLE] = {.name = "HOG", .send = send_mock_hog_report},
+#endif
+#ifdef CONFIG_ZMK_USB
+    [ZMK_ENDPOINT_USB] = {.name = "USB",
+                          .send = send_usb_report,
+#if IS_ENABLED(CONFIG_ZMK_ENDPOINT_QUEUES)
+                          .queue = &usb_report_queue
+#endif
+    },
+#endif
 #ifdef CONFIG_ZMK_BLE
-        err = zmk_hog_send_consumer_report(&consumer_report->body);
+    [ZMK_ENDPOINT_BLE] = {.name = "HOG",
+                          .send = send_hog_report,
+#if IS_ENABLED(CONFIG_ZMK_ENDPOINT_QUEUES)
+                          .queue = &hog_report_queue
+#endif
+    },
+#endif
+};
+
+#if IS_ENABLED(CONFIG_ZMK_ENDPOINT_QUEUES)
+
+// Each transport sends from its own thread, so a congested link or a wait on the USB
+// endpoint never holds up the keymap or the other transport.
+static void endpoint_thread(void *p1, void *p2, void *p3) {
+    struct endpoint *ep = p1;
+    struct queued_report entry;
+
+    for (;;) {
+        k_msgq_get(ep->queue, &entry, K_FOREVER);
+
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+        if (entry.report.usage_page == USAGE_POINTER) {
+            k_spinlock_key_t key = k_spin_lock(&dropped_motion_lock);
+
+            zmk_hid_pointer_report_merge(&entry.report.pointer.body, &ep->dropped_motion);
+            ep->dropped_motion = (struct zmk_hid_pointer_report_body){0};
+            k_spin_unlock(&dropped_motion_lock, key);
+        }
+#endif
+
+        int err = ep->send(&entry.report);
+        u32_t latency_us = k_cyc_to_us_floor32(k_cycle_get_32() - entry.enqueued_cycles);
+
         if (err) {
-            LOG_ERR("FAILED TO SEND OVER HOG: %d", err);
+            LOG_DBG("Failed to send usage page 0x%02X over %s: %d", entry.report.usage_page,
+                    ep->name, err);
+            ep->stats.failed++;
+        } else {
+            ep->stats.sent++;
         }
-#endif /* CONFIG_ZMK_BLE */
 
-        break;
+        ep->stats.last_latency_us = latency_us;
+        ep->stats.max_latency_us = MAX(ep->stats.max_latency_us, latency_us);
+    }
+}
+
+#ifdef CONFIG_ZMK_USB
+K_THREAD_DEFINE(usb_endpoint_thread, CONFIG_ZMK_ENDPOINT_QUEUE_STACK_SIZE, endpoint_thread,
+                &endpoints[ZMK_ENDPOINT_USB], NULL, NULL, CONFIG_ZMK_ENDPOINT_QUEUE_THREAD_PRIORITY,
+                0, 0);
+#endif
+
+#ifdef CONFIG_ZMK_BLE
+K_THREAD_DEFINE(hog_endpoint_thread, CONFIG_ZMK_ENDPOINT_QUEUE_STACK_SIZE, endpoint_thread,
+                &endpoints[ZMK_ENDPOINT_BLE], NULL, NULL, CONFIG_ZMK_ENDPOINT_QUEUE_THREAD_PRIORITY,
+                0, 0);
+#endif
+
+// When the queue is full the oldest snapshot is dropped, since the newest state is the one
+// the host has to end up with.
+static int send_to_endpoint(struct endpoint *ep, struct endpoint_report *report) {
+    struct queued_report entry = {.enqueued_cycles = k_cycle_get_32(), .report = *report};
+    struct queued_report dropped;
+
+    while (k_msgq_put(ep->queue, &entry, K_NO_WAIT) != 0) {
+        if (k_msgq_get(ep->queue, &dropped, K_NO_WAIT) == 0) {
+            LOG_WRN("%s queue full, dropped usage page 0x%02X", ep->name,
+                    dropped.report.usage_page);
+            ep->stats.dropped++;
+
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+            // Pointer motion is relative, so it can't be dropped along with the report.
+            if (dropped.report.usage_page == USAGE_POINTER) {
+                k_spinlock_key_t key = k_spin_lock(&dropped_motion_lock);
+
+                zmk_hid_pointer_report_merge(&ep->dropped_motion, &dropped.report.pointer.body);
+                k_spin_unlock(&dropped_motion_lock, key);
+            }
+#endif
+        }
+    }
+
+    ep->stats.max_depth = MAX(ep->stats.max_depth, k_msgq_num_used_get(ep->queue));
+    return 0;
+}
+
+#else
+
+static int send_to_endpoint(struct endpoint *ep, struct endpoint_report *report) {
+    int err = ep->send(report);
+
+    if (err) {
+        LOG_DBG("Failed to send usage page 0x%02X over %s: %d", report->usage_page, ep->name,
+                err);
+    }
+
+    return err;
+}
+
+#endif /* IS_ENABLED(CONFIG_ZMK_ENDPOINT_QUEUES) */
+
+static int send_report(struct endpoint_report *report) {
+    u32_t *sent = sent_generation(report->usage_page);
+    int err = 0;
+
+    if (*sent == report->generation) {
+        LOG_DBG("usage page 0x%02X unchanged, not sending", report->usage_page);
+        return 0;
+    }
+
+    LOG_DBG("usage page 0x%02X", report->usage_page);
+    if (endpoints[selected_endpoint].send != NULL) {
+        err = send_to_endpoint(&endpoints[selected_endpoint], report);
+    }
+
+    // A report that failed to send is sent again on the next request, even if it has not
+    // changed by then. Queued reports count as sent once queued.
+    if (!err) {
+        *sent = report->generation;
+    }
+
+    return err;
+}
+
+// Whether the report changed again after it was captured, e.g. because pointer motion was
+// left over for another report.
+static bool report_changed_since(struct endpoint_report *report) {
+    return zmk_hid_get_report_generation(report->usage_page) != report->generation;
+}
+
+#if IS_ENABLED(CONFIG_ZMK_REPORT_SCHEDULER)
+
+// Reports are sent from their own work queue, at most one per usage page every
+// CONFIG_ZMK_REPORT_SCHEDULER_INTERVAL_MS, so the event path never waits on a transport.
+K_THREAD_STACK_DEFINE(report_work_q_stack, CONFIG_ZMK_REPORT_SCHEDULER_STACK_SIZE);
+static struct k_work_q report_work_q;
+static struct k_delayed_work report_work;
+static s64_t last_report_time;
+
+// Earlier states that must still reach the host, e.g. a press released before the next
+// interval. These are sent one per interval, ahead of the latest reports.
+K_MSGQ_DEFINE(ordered_reports, sizeof(struct endpoint_report),
+              CONFIG_ZMK_REPORT_SCHEDULER_QUEUE_SIZE, 4);
+
+// Latest state of each report, sent once the interval allows unless superseded before then.
+static struct k_spinlock latest_lock;
+static struct endpoint_report latest_keypad_report;
+static struct endpoint_report latest_consumer_report;
+static u8_t latest_pending;
+static bool report_work_scheduled;
+
+static struct endpoint_report *latest_report(u8_t usage_page) {
+    switch (usage_page) {
+    case USAGE_KEYPAD:
+        return &latest_keypad_report;
+    case USAGE_CONSUMER:
+        return &latest_consumer_report;
     default:
+        return NULL;
+    }
+}
+
+static void schedule_report_work() {
+    k_spinlock_key_t key = k_spin_lock(&latest_lock);
+
+    if (!report_work_scheduled) {
+        s64_t delay = last_report_time + CONFIG_ZMK_REPORT_SCHEDULER_INTERVAL_MS - k_uptime_get();
+
+        report_work_scheduled = true;
+        k_delayed_work_submit_to_queue(&report_work_q, &report_work, K_MSEC(MAX(delay, 0)));
+    }
+
+    k_spin_unlock(&latest_lock, key);
+}
+
+static void send_latest_report(u8_t usage_page) {
+    struct endpoint_report report;
+    bool pending;
+    k_spinlock_key_t key = k_spin_lock(&latest_lock);
+
+    pending = latest_pending & pending_flag(usage_page);
+    if (pending && usage_page != USAGE_POINTER) {
+        report = *latest_report(usage_page);
+    }
+    latest_pending &= ~pending_flag(usage_page);
+
+    k_spin_unlock(&latest_lock, key);
+
+    if (!pending) {
+        return;
+    }
+
+    // The pointer report is captured only when its turn comes, so all motion since the last
+    // tick goes out in one report.
+    if (usage_page == USAGE_POINTER) {
+        capture_report(USAGE_POINTER, &report);
+    }
+
+    send_report(&report);
+
+    if (usage_page == USAGE_POINTER && report_changed_since(&report)) {
+        key = k_spin_lock(&latest_lock);
+        latest_pending |= PENDING_POINTER;
+        k_spin_unlock(&latest_lock, key);
+    }
+}
+
+static void report_work_handler(struct k_work *work) {
+    struct endpoint_report report;
+    k_spinlock_key_t key = k_spin_lock(&latest_lock);
+
+    report_work_scheduled = false;
+    k_spin_unlock(&latest_lock, key);
+
+    last_report_time = k_uptime_get();
+
+    if (k_msgq_get(&ordered_reports, &report, K_NO_WAIT) == 0) {
+        send_report(&report);
+    } else {
+        send_latest_report(USAGE_KEYPAD);
+        send_latest_report(USAGE_CONSUMER);
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+        send_latest_report(USAGE_POINTER);
+#endif
+    }
+
+    if (k_msgq_num_used_get(&ordered_reports) > 0 || latest_pending) {
+        schedule_report_work();
+    }
+}
+
+static int deliver_report(u8_t usage_page) {
+    struct endpoint_report *latest = latest_report(usage_page);
+    k_spinlock_key_t key;
+    int err;
+
+    if (usage_page == USAGE_POINTER && pending_flag(usage_page)) {
+        key = k_spin_lock(&latest_lock);
+        latest_pending |= PENDING_POINTER;
+        k_spin_unlock(&latest_lock, key);
+
+        schedule_report_work();
+        return 0;
+    }
+
+    if (latest == NULL) {
         LOG_ERR("Unsupported usage page %d", usage_page);
         return -ENOTSUP;
     }
 
+    key = k_spin_lock(&latest_lock);
+    err = capture_report(usage_page, latest);
+    latest_pending |= pending_flag(usage_page);
+    k_spin_unlock(&latest_lock, key);
+
+    schedule_report_work();
+    return err;
+}
+
+// Queues the current state of the report so that it is sent before any later state. When the
+// queue is full the state is coalesced into the latest report instead, so the event path never
+// waits for the report thread.
+static int deliver_ordered_report(u8_t usage_page) {
+    struct endpoint_report report;
+    k_spinlock_key_t key = k_spin_lock(&latest_lock);
+    int err;
+
+    if (k_msgq_num_free_get(&ordered_reports) == 0) {
+        k_spin_unlock(&latest_lock, key);
+        LOG_WRN("Ordered report queue full, coalescing usage page 0x%02X", usage_page);
+        return deliver_report(usage_page);
+    }
+
+    err = capture_report(usage_page, &report);
+    if (!err) {
+        latest_pending &= ~pending_flag(usage_page);
+        // Producers only put under latest_lock, so the free entry checked above is still free.
+        k_msgq_put(&ordered_reports, &report, K_NO_WAIT);
+    }
+
+    k_spin_unlock(&latest_lock, key);
+
+    if (!err) {
+        schedule_report_work();
+    }
+
+    return err;
+}
+
+static bool report_scheduled(u8_t usage_page) {
+    k_spinlock_key_t key = k_spin_lock(&latest_lock);
+    bool scheduled = latest_pending & pending_flag(usage_page);
+
+    k_spin_unlock(&latest_lock, key);
+    return scheduled;
+}
+
+static int zmk_endpoints_init(struct device *_arg) {
+    k_work_q_start(&report_work_q, report_work_q_stack,
+                   K_THREAD_STACK_SIZEOF(report_work_q_stack),
+                   CONFIG_ZMK_REPORT_SCHEDULER_THREAD_PRIORITY);
+    k_delayed_work_init(&report_work, report_work_handler);
+
+    return 0;
+}
+
+SYS_INIT(zmk_endpoints_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+
+#else
+
+static int send_current_report(u8_t usage_page) {
+    struct endpoint_report report;
+    int err = capture_report(usage_page, &report);
+
+    if (err) {
+        return err;
+    }
+
+    return send_report(&report);
+}
+
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+
+// Without the report scheduler, pointer reports are still limited to one per interval so fast
+// motion sources don't flood the transports with tiny reports.
+static struct k_delayed_work pointer_work;
+static atomic_t pointer_work_scheduled;
+static s64_t last_pointer_report_time;
+
+static void schedule_pointer_work() {
+    if (atomic_cas(&pointer_work_scheduled, false, true)) {
+        s64_t delay =
+            last_pointer_report_time + CONFIG_ZMK_HID_POINTER_INTERVAL_MS - k_uptime_get();
+
+        k_delayed_work_submit(&pointer_work, K_MSEC(MAX(delay, 0)));
+    }
+}
+
+static void pointer_work_handler(struct k_work *work) {
+    struct endpoint_report report;
+
+    atomic_set(&pointer_work_scheduled, false);
+    last_pointer_report_time = k_uptime_get();
+
+    capture_report(USAGE_POINTER, &report);
+    send_report(&report);
+
+    if (report_changed_since(&report)) {
+        schedule_pointer_work();
+    }
+}
+
+static int zmk_endpoints_init(struct device *_arg) {
+    k_delayed_work_init(&pointer_work, pointer_work_handler);
+
+    return 0;
+}
+
+SYS_INIT(zmk_endpoints_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+
+#endif /* IS_ENABLED(CONFIG_ZMK_HID_POINTER) */
+
+static int deliver_report(u8_t usage_page) {
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+    if (usage_page == USAGE_POINTER) {
+        schedule_pointer_work();
+        return 0;
+    }
+#endif
+
+    return send_current_report(usage_page);
+}
+
+static int deliver_ordered_report(u8_t usage_page) { return send_current_report(usage_page); }
+
+static bool report_scheduled(u8_t usage_page) {
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+    if (usage_page == USAGE_POINTER) {
+        return atomic_get(&pointer_work_scheduled);
+    }
+#endif
+
+    return false;
+}
+
+#endif /* IS_ENABLED(CONFIG_ZMK_REPORT_SCHEDULER) */
+
+int zmk_endpoints_send_report(u8_t usage_page) {
+    u8_t flag = pending_flag(usage_page);
+    k_spinlock_key_t key = k_spin_lock(&batch_lock);
+
+    if (batch_depth > 0 && batch_thread == k_current_get() && flag) {
+        pending_reports |= flag;
+        k_spin_unlock(&batch_lock, key);
+        return 0;
+    }
+
+    k_spin_unlock(&batch_lock, key);
+    return deliver_report(usage_page);
+}
+
+int zmk_endpoints_flush_report(u8_t usage_page) {
+    u8_t flag = pending_flag(usage_page);
+    k_spinlock_key_t key = k_spin_lock(&batch_lock);
+    bool pending = pending_reports & flag;
+
+    pending_reports &= ~flag;
+    k_spin_unlock(&batch_lock, key);
+
+    if (!pending && !report_scheduled(usage_page)) {
+        return 0;
+    }
+
+    return deliver_ordered_report(usage_page);
+}
+
+void zmk_endpoints_batch_begin() {
+    k_spinlock_key_t key = k_spin_lock(&batch_lock);
+
+    // A batch opened while another thread's batch is open is ignored, along with its end.
+    if (batch_depth == 0) {
+        batch_thread = k_current_get();
+    }
+
+    if (batch_thread == k_current_get()) {
+        batch_depth++;
+    }
+
+    k_spin_unlock(&batch_lock, key);
+}
+
+static const u8_t report_pages[] = {
+    USAGE_KEYPAD,
+    USAGE_CONSUMER,
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+    USAGE_POINTER,
+#endif
+};
+
+int zmk_endpoints_batch_end() {
+    int err = 0;
+    u8_t pending;
+    k_spinlock_key_t key = k_spin_lock(&batch_lock);
+
+    if (batch_depth == 0 || batch_thread != k_current_get() || --batch_depth > 0) {
+        k_spin_unlock(&batch_lock, key);
+        return 0;
+    }
+
+    pending = pending_reports;
+    pending_reports = 0;
+    batch_thread = NULL;
+    k_spin_unlock(&batch_lock, key);
+
+    for (int i = 0; i < ARRAY_SIZE(report_pages); i++) {
+        if (pending & pending_flag(report_pages[i])) {
+            int ret = deliver_report(report_pages[i]);
+            err = err ? err : ret;
+        }
+    }
+
+    return err;
+}
+
+#if IS_ENABLED(CONFIG_ZMK_EVENT_MANAGER_DEFERRED)
+
+// Each drain pass of the deferred events sends the reports changed by its events once, at its end.
+static void drain_batch_end() { zmk_endpoints_batch_end(); }
+
+static struct zmk_event_manager_drain_hooks drain_batch_hooks = {
+    .begin = zmk_endpoints_batch_begin,
+    .end = drain_batch_end,
+};
+
+static int zmk_endpoints_drain_init(struct device *_arg) {
+    zmk_event_manager_add_drain_hooks(&drain_batch_hooks);
+
     return 0;
 }
+
+SYS_INIT(zmk_endpoints_drain_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+
+#endif /* IS_ENABLED(CONFIG_ZMK_EVENT_MANAGER_DEFERRED) */
+
+static enum zmk_endpoint preferred_endpoint() {
+    if (endpoint_overridden) {
+        return endpoint_override;
+    }
+
+#if defined(CONFIG_ZMK_USB) && defined(CONFIG_ZMK_BLE)
+    return zmk_usb_hid_is_ready() ? ZMK_ENDPOINT_USB : ZMK_ENDPOINT_BLE;
+#elif defined(CONFIG_ZMK_USB) || IS_ENABLED(CONFIG_ZMK_ENDPOINTS_MOCK)
+    return ZMK_ENDPOINT_USB;
+#else
+    return ZMK_ENDPOINT_BLE;
+#endif
+}
+
+// Sends every report with nothing pressed to an endpoint that is no longer selected, so its host
+// doesn't keep holding the keys and buttons that were down when the reports moved elsewhere.
+static void release_endpoint(struct endpoint *ep) {
+    struct endpoint_report report;
+
+    if (ep->send == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(report_pages); i++) {
+        memset(&report, 0, sizeof(report));
+        report.usage_page = report_pages[i];
+
+        switch (report.usage_page) {
+        case USAGE_KEYPAD:
+            report.keypad.report.report_id = zmk_hid_get_keypad_report()->report_id;
+            break;
+        case USAGE_CONSUMER:
+            report.consumer.report_id = zmk_hid_get_consumer_report()->report_id;
+            break;
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+        case USAGE_POINTER:
+            report.pointer.report_id = zmk_hid_get_pointer_report()->report_id;
+            break;
+#endif
+        }
+
+        send_to_endpoint(ep, &report);
+    }
+}
+
+static void update_selected_endpoint() {
+    enum zmk_endpoint endpoint = preferred_endpoint();
+
+    if (endpoint == selected_endpoint) {
+        return;
+    }
+
+    LOG_INF("Sending reports over %s", endpoints[endpoint].name);
+    release_endpoint(&endpoints[selected_endpoint]);
+    selected_endpoint = endpoint;
+
+    // The newly selected host has not seen the current state of any report yet.
+    for (int i = 0; i < ARRAY_SIZE(report_pages); i++) {
+        *sent_generation(report_pages[i]) = zmk_hid_get_report_generation(report_pages[i]) - 1;
+        zmk_endpoints_send_report(report_pages[i]);
+    }
+
+    struct endpoint_selection_changed *ev = new_endpoint_selection_changed();
+    if (ev == NULL) {
+        return;
+    }
+    ev->endpoint = endpoint;
+
+    ZMK_EVENT_RAISE(ev);
+}
+
+int zmk_endpoints_select(enum zmk_endpoint endpoint) {
+    if (endpoint >= ZMK_ENDPOINT_COUNT || endpoints[endpoint].send == NULL) {
+        return -ENODEV;
+    }
+
+    endpoint_overridden = true;
+    endpoint_override = endpoint;
+    update_selected_endpoint();
+    return 0;
+}
+
+int zmk_endpoints_toggle() {
+    return zmk_endpoints_select(selected_endpoint == ZMK_ENDPOINT_USB ? ZMK_ENDPOINT_BLE
+                                                                      : ZMK_ENDPOINT_USB);
+}
+
+void zmk_endpoints_clear_selection() {
+    endpoint_overridden = false;
+    update_selected_endpoint();
+}
+
+enum zmk_endpoint zmk_endpoints_selected() { return selected_endpoint; }
+
+// Transport callbacks may run in interrupt context, so the selection is updated from the
+// system work queue.
+static void transport_changed_work_handler(struct k_work *work) { update_selected_endpoint(); }
+
+K_WORK_DEFINE(transport_changed_work, transport_changed_work_handler);
+
+void zmk_endpoints_transport_changed() { k_work_submit(&transport_changed_work); }
+
+int zmk_endpoints_get_stats(enum zmk_endpoint endpoint, struct zmk_endpoint_stats *stats) {
+#if IS_ENABLED(CONFIG_ZMK_ENDPOINT_QUEUES)
+    if (endpoint >= ZMK_ENDPOINT_COUNT || endpoints[endpoint].send == NULL) {
+        return -ENODEV;
+    }
+
+    *stats = endpoints[endpoint].stats;
+    stats->depth = k_msgq_num_used_get(endpoints[endpoint].queue);
+    return 0;
+#else
+    return -ENOTSUP;
+#endif
+}
\ No newline at end of file
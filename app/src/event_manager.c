@@ -5,6 +5,7 @@
  */
 
 #include <zephyr.h>
+#include <init.h>
 #include <logging/log.h>
 
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
@@ -17,73 +18,322 @@ extern struct zmk_event_type *__event_type_end[];
 extern struct zmk_event_subscription __event_subscriptions_start[];
 extern struct zmk_event_subscription __event_subscriptions_end[];
 
+#if IS_ENABLED(CONFIG_ZMK_EVENT_TRACE)
+
+#include <zmk/event-trace.h>
+
+static int zmk_event_manager_call(const struct zmk_listener *listener,
+                                  struct zmk_event_header *event) {
+    enum zmk_event_trace_op op = ZMK_EVENT_TRACE_CALLBACK;
+    // A listener that captures the event may release and free it before returning.
+    const struct zmk_event_type *event_type = event->event;
+    u32_t start = zmk_event_trace_timestamp();
+    int ret = listener->callback(event);
+    u32_t duration = zmk_event_trace_timestamp() - start;
+
+    if (ret < 0) {
+        op = ZMK_EVENT_TRACE_ERROR;
+    } else if (ret == ZMK_EV_EVENT_HANDLED) {
+        op = ZMK_EVENT_TRACE_HANDLED;
+    } else if (ret == ZMK_EV_EVENT_CAPTURED) {
+        op = ZMK_EVENT_TRACE_CAPTURED;
+    }
+
+    zmk_event_trace_record(op, event, event_type, listener, start, duration);
+    return ret;
+}
+
+#define TRACE_EVENT(op, ev)                                                                        \
+    zmk_event_trace_record(op, ev, (ev)->event, NULL, zmk_event_trace_timestamp(), 0)
+
+#else
+
+#define zmk_event_manager_call(listener, event) (listener)->callback(event)
+#define TRACE_EVENT(op, event)
+
+#endif /* IS_ENABLED(CONFIG_ZMK_EVENT_TRACE) */
+
+struct zmk_event_header *zmk_event_manager_alloc(const struct zmk_event_type *type) {
+    struct zmk_event_pool *pool = type->pool;
+    struct zmk_event_header *event;
+    u32_t used;
+
+    if (k_mem_slab_alloc(pool->slab, (void **)&event, K_NO_WAIT) != 0) {
+        pool->alloc_failures++;
+        LOG_ERR("Event pool for %s exhausted (%d failures)", type->name, pool->alloc_failures);
+        return NULL;
+    }
+
+    used = k_mem_slab_num_used_get(pool->slab);
+    if (used > pool->high_water) {
+        pool->high_water = used;
+    }
+
+    event->event = type;
+    return event;
+}
+
+void zmk_event_manager_free(struct zmk_event_header *event) {
+    k_mem_slab_free(event->event->pool->slab, (void **)&event);
+}
+
+static inline bool zmk_event_subscription_matches(const struct zmk_event_subscription *ev_sub,
+                                                  const struct zmk_event_header *event) {
+    const struct zmk_event_type *type = event->event;
+    const u8_t *payload = (const u8_t *)event;
+
+    if (type->filter_state_offset &&
+        !(ev_sub->state_mask & BIT(*(const bool *)(payload + type->filter_state_offset)))) {
+        return false;
+    }
+
+    if (type->filter_key_offset &&
+        !(ev_sub->key_mask &
+          ZMK_EV_FILTER_KEY(*(const u32_t *)(payload + type->filter_key_offset)))) {
+        return false;
+    }
+
+    return true;
+}
+
 int zmk_event_manager_handle_from(struct zmk_event_header *event, u8_t start_index) {
     int ret = 0;
-    u8_t len = __event_subscriptions_end - __event_subscriptions_start;
-    for (int i = start_index; i < len; i++) {
+    const struct zmk_event_subscribers *subs = event->event->subscribers;
+    u8_t end = subs->start + subs->len;
+
+    if (start_index < subs->start) {
+        start_index = subs->start;
+    }
+
+    for (int i = start_index; i < end; i++) {
         struct zmk_event_subscription *ev_sub = __event_subscriptions_start + i;
-        if (ev_sub->event_type == event->event) {
-            ret = ev_sub->listener->callback(event);
-            if (ret < 0) {
-                LOG_DBG("Listener returned an error: %d", ret);
+        if (!zmk_event_subscription_matches(ev_sub, event)) {
+            continue;
+        }
+        ret = zmk_event_manager_call(ev_sub->listener, event);
+        if (ret < 0) {
+            LOG_DBG("Listener returned an error: %d", ret);
+            goto release;
+        } else if (ret > 0) {
+            switch (ret) {
+            case ZMK_EV_EVENT_HANDLED:
+                LOG_DBG("Listener handled the event");
+                ret = 0;
                 goto release;
-            } else if (ret > 0) {
-                switch (ret) {
-                case ZMK_EV_EVENT_HANDLED:
-                    LOG_DBG("Listener handled the event");
-                    ret = 0;
-                    goto release;
-                case ZMK_EV_EVENT_CAPTURED:
-                    LOG_DBG("Listener captured the event");
-                    event->last_listener_index = i;
-                    // Listeners are expected to free events they capture
-                    return 0;
-                }
+            case ZMK_EV_EVENT_CAPTURED:
+                LOG_DBG("Listener captured the event");
+                event->last_listener_index = i;
+                // Listeners are expected to free events they capture
+                return 0;
             }
         }
     }
 
 release:
-    k_free(event);
+    zmk_event_manager_free(event);
     return ret;
 }
 
+static int zmk_event_manager_listener_index(const struct zmk_event_header *event,
+                                            const struct zmk_listener *listener) {
+    const struct zmk_event_subscribers *subs = event->event->subscribers;
+    u8_t end = subs->start + subs->len;
+
+    // Captured events remember the slot of the listener that captured them, which is
+    // almost always the one they are raised at/after again.
+    if (event->last_listener_index >= subs->start && event->last_listener_index < end &&
+        __event_subscriptions_start[event->last_listener_index].listener == listener) {
+        return event->last_listener_index;
+    }
+
+    for (int i = subs->start; i < end; i++) {
+        if (__event_subscriptions_start[i].listener == listener) {
+            return i;
+        }
+    }
+
+    return -EINVAL;
+}
+
 int zmk_event_manager_raise(struct zmk_event_header *event) {
+    if (event == NULL) {
+        return -ENOMEM;
+    }
+
+    TRACE_EVENT(ZMK_EVENT_TRACE_RAISE, event);
     return zmk_event_manager_handle_from(event, 0);
 }
 
 int zmk_event_manager_raise_after(struct zmk_event_header *event,
                                   const struct zmk_listener *listener) {
-    u8_t len = __event_subscriptions_end - __event_subscriptions_start;
-    for (int i = 0; i < len; i++) {
-        struct zmk_event_subscription *ev_sub = __event_subscriptions_start + i;
+    int index = zmk_event_manager_listener_index(event, listener);
 
-        if (ev_sub->event_type == event->event && ev_sub->listener == listener) {
-            return zmk_event_manager_handle_from(event, i + 1);
-        }
+    if (index < 0) {
+        LOG_WRN("Unable to find where to raise this after event");
+        return index;
     }
 
-    LOG_WRN("Unable to find where to raise this after event");
-
-    return -EINVAL;
+    TRACE_EVENT(ZMK_EVENT_TRACE_RAISE, event);
+    return zmk_event_manager_handle_from(event, index + 1);
 }
 
 int zmk_event_manager_raise_at(struct zmk_event_header *event,
                                const struct zmk_listener *listener) {
+    int index = zmk_event_manager_listener_index(event, listener);
+
+    if (index < 0) {
+        LOG_WRN("Unable to find where to raise this event");
+        return index;
+    }
+
+    TRACE_EVENT(ZMK_EVENT_TRACE_RAISE, event);
+    return zmk_event_manager_handle_from(event, index);
+}
+
+int zmk_event_manager_release(struct zmk_event_header *event) {
+    TRACE_EVENT(ZMK_EVENT_TRACE_RELEASE, event);
+    return zmk_event_manager_handle_from(event, event->last_listener_index + 1);
+}
+
+#if IS_ENABLED(CONFIG_ZMK_EVENT_MANAGER_DEFERRED)
+
+#define DEFERRED_QUEUE_SIZE CONFIG_ZMK_EVENT_MANAGER_DEFERRED_QUEUE_SIZE
+
+struct deferred_event {
+    struct zmk_event_header *event;
+    u8_t start_index;
+};
+
+// Deferred events are dispatched one at a time from a work item. Events deferred while
+// one is being dispatched, and captured events being re-raised, are staged and then put
+// back at the front of the queue, so they are processed in the same order the nested
+// synchronous calls would have processed them, without growing the stack.
+static struct deferred_event deferred_events[DEFERRED_QUEUE_SIZE];
+static u8_t deferred_head;
+static u8_t deferred_len;
+static struct deferred_event staged_events[DEFERRED_QUEUE_SIZE];
+static u8_t staged_len;
+static k_tid_t draining_thread;
+static struct k_spinlock deferred_lock;
+static struct k_work deferred_work;
+static sys_slist_t drain_hooks = SYS_SLIST_STATIC_INIT(&drain_hooks);
+
+void zmk_event_manager_add_drain_hooks(struct zmk_event_manager_drain_hooks *hooks) {
+    sys_slist_append(&drain_hooks, &hooks->node);
+}
+
+static void unstage_deferred_events() {
+    for (int i = staged_len - 1; i >= 0; i--) {
+        deferred_head = (deferred_head + DEFERRED_QUEUE_SIZE - 1) % DEFERRED_QUEUE_SIZE;
+        deferred_events[deferred_head] = staged_events[i];
+        deferred_len++;
+    }
+    staged_len = 0;
+}
+
+static void zmk_event_manager_drain(struct k_work *work) {
+    struct zmk_event_manager_drain_hooks *hooks;
+    struct deferred_event next;
+    k_spinlock_key_t key;
+
+    SYS_SLIST_FOR_EACH_CONTAINER(&drain_hooks, hooks, node) { hooks->begin(); }
+
+    key = k_spin_lock(&deferred_lock);
+
+    draining_thread = k_current_get();
+    unstage_deferred_events();
+
+    while (deferred_len > 0) {
+        next = deferred_events[deferred_head];
+        deferred_head = (deferred_head + 1) % DEFERRED_QUEUE_SIZE;
+        deferred_len--;
+        k_spin_unlock(&deferred_lock, key);
+
+        TRACE_EVENT(ZMK_EVENT_TRACE_RAISE, next.event);
+        zmk_event_manager_handle_from(next.event, next.start_index);
+
+        key = k_spin_lock(&deferred_lock);
+        unstage_deferred_events();
+    }
+
+    draining_thread = NULL;
+    k_spin_unlock(&deferred_lock, key);
+
+    SYS_SLIST_FOR_EACH_CONTAINER(&drain_hooks, hooks, node) { hooks->end(); }
+}
+
+static int zmk_event_manager_defer(struct zmk_event_header *event, u8_t start_index,
+                                   bool front) {
+    k_spinlock_key_t key = k_spin_lock(&deferred_lock);
+
+    if (deferred_len + staged_len >= DEFERRED_QUEUE_SIZE) {
+        k_spin_unlock(&deferred_lock, key);
+        LOG_WRN("Deferred event queue full, raising %s synchronously", event->event->name);
+        TRACE_EVENT(ZMK_EVENT_TRACE_RAISE, event);
+        return zmk_event_manager_handle_from(event, start_index);
+    }
+
+    if (front || draining_thread == k_current_get()) {
+        staged_events[staged_len++] =
+            (struct deferred_event){.event = event, .start_index = start_index};
+    } else {
+        deferred_events[(deferred_head + deferred_len) % DEFERRED_QUEUE_SIZE] =
+            (struct deferred_event){.event = event, .start_index = start_index};
+        deferred_len++;
+    }
+
+    k_spin_unlock(&deferred_lock, key);
+    k_work_submit(&deferred_work);
+
+    return 0;
+}
+
+int zmk_event_manager_raise_deferred(struct zmk_event_header *event) {
+    if (event == NULL) {
+        return -ENOMEM;
+    }
+
+    return zmk_event_manager_defer(event, 0, false);
+}
+
+int zmk_event_manager_raise_at_deferred(struct zmk_event_header *event,
+                                        const struct zmk_listener *listener) {
+    int index = zmk_event_manager_listener_index(event, listener);
+
+    if (index < 0) {
+        LOG_WRN("Unable to find where to raise this event");
+        return index;
+    }
+
+    // Events raised at a listener are re-raises of captured events, which are older than
+    // anything still waiting in the queue.
+    return zmk_event_manager_defer(event, index, true);
+}
+
+#endif /* IS_ENABLED(CONFIG_ZMK_EVENT_MANAGER_DEFERRED) */
+
+static int zmk_event_manager_init(struct device *_arg) {
     u8_t len = __event_subscriptions_end - __event_subscriptions_start;
+
     for (int i = 0; i < len; i++) {
-        struct zmk_event_subscription *ev_sub = __event_subscriptions_start + i;
+        struct zmk_event_subscribers *subs = __event_subscriptions_start[i].event_type->subscribers;
 
-        if (ev_sub->event_type == event->event && ev_sub->listener == listener) {
-            return zmk_event_manager_handle_from(event, i);
+        if (subs->len == 0) {
+            subs->start = i;
+        } else if (subs->start + subs->len != i) {
+            LOG_ERR("Subscriptions for %s are not contiguous",
+                    __event_subscriptions_start[i].event_type->name);
+            return -EINVAL;
         }
+
+        subs->len++;
     }
 
-    LOG_WRN("Unable to find where to raise this event");
+#if IS_ENABLED(CONFIG_ZMK_EVENT_MANAGER_DEFERRED)
+    k_work_init(&deferred_work, zmk_event_manager_drain);
+#endif
 
-    return -EINVAL;
+    return 0;
 }
 
-int zmk_event_manager_release(struct zmk_event_header *event) {
-    return zmk_event_manager_handle_from(event, event->last_listener_index + 1);
-}
+SYS_INIT(zmk_event_manager_init, PRE_KERNEL_1, 0);
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2020 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <zephyr.h>
+#include <sys/printk.h>
+
+#include <zmk/event-trace.h>
+
+#if IS_ENABLED(CONFIG_BOARD_NATIVE_POSIX)
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "cmdline.h"
+#include "soc.h"
+#endif
+
+static struct zmk_event_trace_entry entries[CONFIG_ZMK_EVENT_TRACE_BUFFER_SIZE];
+static u32_t next_entry;
+
+static const char *op_names[] = {
+    [ZMK_EVENT_TRACE_RAISE] = "raise",       [ZMK_EVENT_TRACE_RELEASE] = "release",
+    [ZMK_EVENT_TRACE_CALLBACK] = "callback", [ZMK_EVENT_TRACE_HANDLED] = "handled",
+    [ZMK_EVENT_TRACE_CAPTURED] = "captured", [ZMK_EVENT_TRACE_ERROR] = "error",
+};
+
+u32_t zmk_event_trace_timestamp() {
+#if IS_ENABLED(CONFIG_BOARD_NATIVE_POSIX)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u32_t)(ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec);
+#else
+    return k_cycle_get_32();
+#endif
+}
+
+void zmk_event_trace_record(enum zmk_event_trace_op op, const struct zmk_event_header *event,
+                            const struct zmk_event_type *event_type,
+                            const struct zmk_listener *listener, u32_t timestamp, u32_t duration) {
+    unsigned int key = irq_lock();
+    struct zmk_event_trace_entry *entry =
+        &entries[next_entry++ % CONFIG_ZMK_EVENT_TRACE_BUFFER_SIZE];
+
+    entry->timestamp = timestamp;
+    entry->duration = duration;
+    entry->event = event;
+    entry->event_type = event_type;
+    entry->listener = listener;
+    entry->op = op;
+
+    irq_unlock(key);
+}
+
+#define TRACE_HEADER "seq,timestamp,duration,event_id,event,op,listener\n"
+
+static u32_t first_entry() {
+    return next_entry > CONFIG_ZMK_EVENT_TRACE_BUFFER_SIZE
+               ? next_entry - CONFIG_ZMK_EVENT_TRACE_BUFFER_SIZE
+               : 0;
+}
+
+static int format_entry(char *buf, size_t len, u32_t seq) {
+    const struct zmk_event_trace_entry *e = &entries[seq % CONFIG_ZMK_EVENT_TRACE_BUFFER_SIZE];
+
+    return snprintk(buf, len, "%u,%u,%u,%p,%s,%s,%s\n", seq, e->timestamp, e->duration, e->event,
+                    e->event_type->name, op_names[e->op], e->listener ? e->listener->name : "");
+}
+
+void zmk_event_trace_dump() {
+    char line[96];
+
+    printk(TRACE_HEADER);
+    for (u32_t seq = first_entry(); seq != next_entry; seq++) {
+        format_entry(line, sizeof(line), seq);
+        printk("%s", line);
+    }
+}
+
+#if IS_ENABLED(CONFIG_BOARD_NATIVE_POSIX)
+
+static char *trace_path;
+
+static void zmk_event_trace_write_file() {
+    FILE *file = fopen(trace_path, "w");
+
+    if (file == NULL) {
+        fprintf(stderr, "Unable to open event trace file %s\n", trace_path);
+        return;
+    }
+
+    char line[96];
+
+    fputs(TRACE_HEADER, file);
+    for (u32_t seq = first_entry(); seq != next_entry; seq++) {
+        format_entry(line, sizeof(line), seq);
+        fputs(line, file);
+    }
+    fclose(file);
+}
+
+static void zmk_event_trace_options() {
+    static struct args_struct_t trace_options[] = {
+        {.manual = false,
+         .is_mandatory = false,
+         .is_switch = false,
+         .option = "event-trace",
+         .name = "path",
+         .type = 's',
+         .dest = (void *)&trace_path,
+         .call_when_found = NULL,
+         .descript = "Write the event trace ring buffer to this file as CSV on exit"},
+        ARG_TABLE_ENDMARKER};
+
+    native_add_command_line_opts(trace_options);
+}
+
+static void zmk_event_trace_register_exit() {
+    if (trace_path != NULL) {
+        atexit(zmk_event_trace_write_file);
+    }
+}
+
+NATIVE_TASK(zmk_event_trace_options, PRE_BOOT_1, 1);
+NATIVE_TASK(zmk_event_trace_register_exit, PRE_BOOT_3, 1);
+
+#endif /* IS_ENABLED(CONFIG_BOARD_NATIVE_POSIX) */
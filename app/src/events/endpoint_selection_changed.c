@@ -0,0 +1,10 @@
+/*
+ * Copyright (c) 2020 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <kernel.h>
+#include <zmk/events/endpoint-selection-changed.h>
+
+ZMK_EVENT_IMPL(endpoint_selection_changed);
\ No newline at end of file
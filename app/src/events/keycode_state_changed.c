@@ -7,4 +7,5 @@
 #include <kernel.h>
 #include <zmk/events/keycode-state-changed.h>
 
-ZMK_EVENT_IMPL(keycode_state_changed);
+ZMK_EVENT_IMPL_FILTERABLE_POOL(keycode_state_changed, CONFIG_ZMK_EVENT_CAPTURED_POOL_SIZE,
+                               keycode, state);
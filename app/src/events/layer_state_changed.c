@@ -0,0 +1,10 @@
+/*
+ * Copyright (c) 2020 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <kernel.h>
+#include <zmk/events/layer-state-changed.h>
+
+ZMK_EVENT_IMPL_FILTERABLE(layer_state_changed, layer, state);
\ No newline at end of file
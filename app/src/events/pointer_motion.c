@@ -0,0 +1,10 @@
+/*
+ * Copyright (c) 2020 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <kernel.h>
+#include <zmk/events/pointer-motion.h>
+
+ZMK_EVENT_IMPL(pointer_motion);
\ No newline at end of file
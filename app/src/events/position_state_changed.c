@@ -7,4 +7,5 @@
 #include <kernel.h>
 #include <zmk/events/position-state-changed.h>
 
-ZMK_EVENT_IMPL(position_state_changed);
\ No newline at end of file
+ZMK_EVENT_IMPL_FILTERABLE_POOL(position_state_changed, CONFIG_ZMK_EVENT_CAPTURED_POOL_SIZE,
+                               position, state);
\ No newline at end of file
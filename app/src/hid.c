@@ -4,64 +4,211 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <string.h>
 #include <logging/log.h>
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
 #include <zmk/hid.h>
 
-static struct zmk_hid_keypad_report kp_report = {
-    .report_id = 1, .body = {.modifiers = 0, .keys = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}}};
+static struct zmk_hid_keypad_report kp_report = {.report_id = 1, .body = {.modifiers = 0}};
 
-static struct zmk_hid_consumer_report consumer_report = {.report_id = 2,
-                                                         .body = {.keys = {0, 0, 0, 0, 0, 0}}};
+#if IS_ENABLED(CONFIG_ZMK_HID_REPORT_TYPE_HKRO)
+// The keypad report already has the boot layout, so its body doubles as the boot report.
+BUILD_ASSERT(sizeof(struct zmk_hid_keypad_report_body) == sizeof(struct zmk_hid_boot_report),
+             "Keypad report body must match the boot report");
+
+static struct zmk_hid_boot_report *const boot_report =
+    (struct zmk_hid_boot_report *)&kp_report.body;
+#else
+static struct zmk_hid_boot_report boot_report_buffer;
+static struct zmk_hid_boot_report *const boot_report = &boot_report_buffer;
+#endif
+
+static struct zmk_hid_consumer_report consumer_report = {.report_id = 2, .body = {.keys = {0}}};
+
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+static struct zmk_hid_pointer_report pointer_report = {.report_id = 3, .body = {.buttons = 0}};
+
+// Motion not reported yet. Sources may add to it from any thread.
+static struct k_spinlock pointer_lock;
+static s32_t pointer_x, pointer_y, pointer_wheel, pointer_pan;
+#endif
+
+// Bumped whenever the contents of a report change, so endpoints can skip sending a report
+// that is identical to the last one they sent.
+static u32_t kp_report_generation;
+static u32_t consumer_report_generation;
+static u32_t pointer_report_generation;
+
+static void set_keypad_modifiers(zmk_mod_flags modifiers) {
+    if (kp_report.body.modifiers != modifiers) {
+        kp_report.body.modifiers = modifiers;
+        boot_report->modifiers = modifiers;
+        kp_report_generation++;
+    }
+}
 
 #define _TOGGLE_MOD(mod, state)                                                                    \
     if (modifier > MOD_RGUI) {                                                                     \
         return -EINVAL;                                                                            \
     }                                                                                              \
-    WRITE_BIT(kp_report.body.modifiers, mod, state);                                               \
+    set_keypad_modifiers(state ? (kp_report.body.modifiers | BIT(mod))                            \
+                               : (kp_report.body.modifiers & ~BIT(mod)));                          \
     return 0;
 
 int zmk_hid_register_mod(zmk_mod modifier) { _TOGGLE_MOD(modifier, true); }
 int zmk_hid_unregister_mod(zmk_mod modifier) { _TOGGLE_MOD(modifier, false); }
 
 int zmk_hid_register_mods(zmk_mod_flags modifiers) {
-    kp_report.body.modifiers |= modifiers;
+    set_keypad_modifiers(kp_report.body.modifiers | modifiers);
     return 0;
 }
 
 int zmk_hid_unregister_mods(zmk_mod_flags modifiers) {
-    kp_report.body.modifiers &= ~modifiers;
+    set_keypad_modifiers(kp_report.body.modifiers & ~modifiers);
     return 0;
 }
 
-#define KEY_OFFSET 0x02
-#define MAX_KEYS 6
+// In HKRO mode the keypad report is the boot report, so keys pressed while all of its slots are
+// taken are left out of both.
+static bool set_boot_key(zmk_key code, bool pressed) {
+    int free_idx = -1;
 
-/*
-#define TOGGLE_BOOT_KEY(match, val)                      \
-    for (int idx = 0; idx < MAX_KEYS; idx++)             \
-    {                                                    \
-        if (kp_report.boot.keys[idx + KEY_OFFSET] != match) \
-        {                                                \
-            continue;                                    \
-        }                                                \
-        kp_report.boot.keys[idx + KEY_OFFSET] = val;        \
-        break;                                           \
+    for (int idx = 0; idx < ZMK_HID_BOOT_KEYS; idx++) {
+        if (boot_report->keys[idx] == code) {
+            if (!pressed) {
+                boot_report->keys[idx] = 0;
+            }
+            return !pressed;
+        }
+
+        if (boot_report->keys[idx] == 0 && free_idx < 0) {
+            free_idx = idx;
+        }
+    }
+
+    if (!pressed || free_idx < 0) {
+        return false;
+    }
+
+    boot_report->keys[free_idx] = code;
+    return true;
+}
+
+#if IS_ENABLED(CONFIG_ZMK_HID_REPORT_TYPE_HKRO)
+#define TOGGLE_KEY(code, val)                                                                      \
+    if (set_boot_key(code, val)) {                                                                 \
+        kp_report_generation++;                                                                    \
     }
-*/
+#else
+// Number of keys set in the NKRO bitmap.
+static u8_t nkro_key_count;
 
-#define TOGGLE_KEY(code, val) WRITE_BIT(kp_report.body.keys[code / 8], code % 8, val)
+static bool set_nkro_key(zmk_key code, bool pressed) {
+    u8_t *byte = &kp_report.body.keys[code / 8];
+    u8_t updated = pressed ? (*byte | BIT(code % 8)) : (*byte & ~BIT(code % 8));
 
-#define TOGGLE_CONSUMER(match, val)                                                                \
-    for (int idx = 0; idx < MAX_KEYS; idx++) {                                                     \
-        if (consumer_report.body.keys[idx] != match) {                                             \
-            continue;                                                                              \
-        }                                                                                          \
-        consumer_report.body.keys[idx] = val;                                                      \
-        break;                                                                                     \
+    if (*byte == updated) {
+        return false;
     }
 
+    *byte = updated;
+    nkro_key_count += pressed ? 1 : -1;
+    return true;
+}
+
+static bool boot_keys_rolled_over() {
+    return boot_report->keys[0] == ZMK_HID_BOOT_ERROR_ROLLOVER;
+}
+
+// Refills the boot report slots from the NKRO bitmap once keys are released back under the limit.
+static void rebuild_boot_keys() {
+    int idx = 0;
+
+    memset(boot_report->keys, 0, sizeof(boot_report->keys));
+
+    for (int code = 0; code <= ZMK_HID_MAX_KEYCODE && idx < ZMK_HID_BOOT_KEYS; code++) {
+        if (kp_report.body.keys[code / 8] & BIT(code % 8)) {
+            boot_report->keys[idx++] = code;
+        }
+    }
+}
+
+// While more keys are down than the boot report has slots for, every slot reports
+// ErrorRollOver, so boot protocol hosts know some keys are missing instead of seeing a partial
+// set of keys.
+static void update_boot_keys(zmk_key code, bool pressed) {
+    if (nkro_key_count > ZMK_HID_BOOT_KEYS) {
+        memset(boot_report->keys, ZMK_HID_BOOT_ERROR_ROLLOVER, sizeof(boot_report->keys));
+    } else if (boot_keys_rolled_over()) {
+        rebuild_boot_keys();
+    } else {
+        set_boot_key(code, pressed);
+    }
+}
+
+#define TOGGLE_KEY(code, val)                                                                      \
+    if (set_nkro_key(code, val)) {                                                                 \
+        update_boot_keys(code, val);                                                               \
+        kp_report_generation++;                                                                    \
+    }
+#endif
+
+#define CONSUMER_SLOTS CONFIG_ZMK_HID_CONSUMER_REPORT_SIZE
+
+// Open addressed hash from usage to report slot, kept at most half full so lookups stay
+// constant time. Entries hold the slot plus one, zero marks an empty bucket.
+#define CONSUMER_INDEX_SIZE (CONSUMER_SLOTS * 2)
+
+static u8_t consumer_index[CONSUMER_INDEX_SIZE];
+
+// Report slots released since they were first used, reused before untouched slots.
+static u8_t consumer_free_slots[CONSUMER_SLOTS];
+static u8_t consumer_free_count;
+static u8_t consumer_slots_used;
+
+static u32_t consumer_overflow_count;
+
+static u8_t consumer_bucket(u16_t usage) {
+    return ((usage * 0x9E3779B1U) >> 16) % CONSUMER_INDEX_SIZE;
+}
+
+// Returns the bucket holding usage, or the empty bucket where it would be inserted.
+static u8_t consumer_find(u16_t usage) {
+    u8_t bucket = consumer_bucket(usage);
+
+    while (consumer_index[bucket] != 0 &&
+           consumer_report.body.keys[consumer_index[bucket] - 1] != usage) {
+        bucket = (bucket + 1) % CONSUMER_INDEX_SIZE;
+    }
+
+    return bucket;
+}
+
+// Shifts later entries of the probe sequence back into the emptied bucket, so lookups never
+// stop early at a hole.
+static void consumer_remove(u8_t bucket) {
+    u8_t next = bucket;
+
+    consumer_index[bucket] = 0;
+
+    for (;;) {
+        next = (next + 1) % CONSUMER_INDEX_SIZE;
+        if (consumer_index[next] == 0) {
+            return;
+        }
+
+        u8_t home = consumer_bucket(consumer_report.body.keys[consumer_index[next] - 1]);
+        bool movable = (bucket <= next) ? (home <= bucket || home > next)
+                                        : (home <= bucket && home > next);
+        if (movable) {
+            consumer_index[bucket] = consumer_index[next];
+            consumer_index[next] = 0;
+            bucket = next;
+        }
+    }
+}
+
 int zmk_hid_keypad_press(zmk_key code) {
     if (code >= LCTL && code <= RGUI) {
         return zmk_hid_register_mod(code - LCTL);
@@ -71,8 +218,6 @@ int zmk_hid_keypad_press(zmk_key code) {
         return -EINVAL;
     }
 
-    // TOGGLE_BOOT_KEY(0U, code);
-
     TOGGLE_KEY(code, true);
 
     return 0;
@@ -87,23 +232,144 @@ int zmk_hid_keypad_release(zmk_key code) {
         return -EINVAL;
     }
 
-    // TOGGLE_BOOT_KEY(0U, code);
-
     TOGGLE_KEY(code, false);
 
     return 0;
 };
 
 int zmk_hid_consumer_press(zmk_key code) {
-    TOGGLE_CONSUMER(0U, code);
+    u8_t bucket, slot;
+
+    if (code == 0 || code > ZMK_HID_MAX_CONSUMER_USAGE) {
+        return -EINVAL;
+    }
+
+    bucket = consumer_find(code);
+    if (consumer_index[bucket] != 0) {
+        return 0;
+    }
+
+    if (consumer_free_count > 0) {
+        slot = consumer_free_slots[--consumer_free_count];
+    } else if (consumer_slots_used < CONSUMER_SLOTS) {
+        slot = consumer_slots_used++;
+    } else {
+        consumer_overflow_count++;
+        LOG_WRN("No free consumer report slot for usage 0x%04X", code);
+        return -ENOMEM;
+    }
+
+    consumer_report.body.keys[slot] = code;
+    consumer_index[bucket] = slot + 1;
+    consumer_report_generation++;
     return 0;
 };
 
 int zmk_hid_consumer_release(zmk_key code) {
-    TOGGLE_CONSUMER(code, 0U);
+    u8_t bucket, slot;
+
+    if (code == 0 || code > ZMK_HID_MAX_CONSUMER_USAGE) {
+        return -EINVAL;
+    }
+
+    bucket = consumer_find(code);
+    if (consumer_index[bucket] == 0) {
+        return 0;
+    }
+
+    slot = consumer_index[bucket] - 1;
+    consumer_remove(bucket);
+    consumer_report.body.keys[slot] = 0;
+    consumer_free_slots[consumer_free_count++] = slot;
+    consumer_report_generation++;
     return 0;
 };
 
+u32_t zmk_hid_get_consumer_overflow_count() { return consumer_overflow_count; }
+
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+
+static int set_pointer_button(zmk_key button, bool pressed) {
+    u8_t buttons;
+
+    if (button < 1 || button > ZMK_HID_POINTER_BUTTONS) {
+        return -EINVAL;
+    }
+
+    buttons = pressed ? (pointer_report.body.buttons | BIT(button - 1))
+                      : (pointer_report.body.buttons & ~BIT(button - 1));
+    if (pointer_report.body.buttons != buttons) {
+        pointer_report.body.buttons = buttons;
+        pointer_report_generation++;
+    }
+
+    return 0;
+}
+
+int zmk_hid_pointer_button_press(zmk_key button) { return set_pointer_button(button, true); }
+
+int zmk_hid_pointer_button_release(zmk_key button) { return set_pointer_button(button, false); }
+
+void zmk_hid_pointer_move(s16_t x, s16_t y, s16_t wheel, s16_t pan) {
+    k_spinlock_key_t key;
+
+    if (x == 0 && y == 0 && wheel == 0 && pan == 0) {
+        return;
+    }
+
+    key = k_spin_lock(&pointer_lock);
+    pointer_x += x;
+    pointer_y += y;
+    pointer_wheel += wheel;
+    pointer_pan += pan;
+    pointer_report_generation++;
+    k_spin_unlock(&pointer_lock, key);
+}
+
+static s8_t take_axis(s32_t *pending) {
+    s32_t value = MAX(MIN(*pending, 127), -127);
+
+    *pending -= value;
+    return value;
+}
+
+bool zmk_hid_pointer_take_motion() {
+    bool remaining;
+    k_spinlock_key_t key = k_spin_lock(&pointer_lock);
+
+    pointer_report.body.x = take_axis(&pointer_x);
+    pointer_report.body.y = take_axis(&pointer_y);
+    pointer_report.body.wheel = take_axis(&pointer_wheel);
+    pointer_report.body.pan = take_axis(&pointer_pan);
+
+    remaining = pointer_x != 0 || pointer_y != 0 || pointer_wheel != 0 || pointer_pan != 0;
+    // Leftover motion has to go out in another report, even if nothing else changes.
+    if (remaining) {
+        pointer_report_generation++;
+    }
+
+    k_spin_unlock(&pointer_lock, key);
+    return remaining;
+}
+
+static s8_t merge_axis(s8_t value, s8_t earlier) {
+    return MAX(MIN((s16_t)value + earlier, 127), -127);
+}
+
+void zmk_hid_pointer_report_merge(struct zmk_hid_pointer_report_body *report,
+                                  const struct zmk_hid_pointer_report_body *earlier) {
+    report->x = merge_axis(report->x, earlier->x);
+    report->y = merge_axis(report->y, earlier->y);
+    report->wheel = merge_axis(report->wheel, earlier->wheel);
+    report->pan = merge_axis(report->pan, earlier->pan);
+}
+
+struct zmk_hid_pointer_report *zmk_hid_get_pointer_report() {
+    return &pointer_report;
+}
+
+#endif /* IS_ENABLED(CONFIG_ZMK_HID_POINTER) */
+
 struct zmk_hid_keypad_report *zmk_hid_get_keypad_report() {
     return &kp_report;
 }
@@ -111,3 +377,18 @@ struct zmk_hid_keypad_report *zmk_hid_get_keypad_report() {
 struct zmk_hid_consumer_report *zmk_hid_get_consumer_report() {
     return &consumer_report;
 }
+
+struct zmk_hid_boot_report *zmk_hid_get_boot_report() { return boot_report; }
+
+u32_t zmk_hid_get_report_generation(u8_t usage_page) {
+    switch (usage_page) {
+    case USAGE_KEYPAD:
+        return kp_report_generation;
+    case USAGE_CONSUMER:
+        return consumer_report_generation;
+    case USAGE_POINTER:
+        return pointer_report_generation;
+    default:
+        return 0;
+    }
+}
@@ -12,9 +12,34 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 #include <zmk/event-manager.h>
 #include <zmk/events/keycode-state-changed.h>
 #include <zmk/events/modifiers-state-changed.h>
+#include <zmk/events/pointer-motion.h>
 #include <zmk/hid.h>
 #include <zmk/endpoints.h>
 
+// Usage pages with a press that may still be pending in an open endpoints batch. A release
+// on the same page flushes that report first, so a press and release within one batch
+// still reach the host as two reports.
+static u8_t batched_press_pages;
+
+#define BATCHED_PAGE_BIT(usage_page)                                                               \
+    BIT((usage_page) == USAGE_CONSUMER ? 1 : ((usage_page) == USAGE_POINTER ? 2 : 0))
+
+// Buttons are sent as part of the pointer report.
+static u8_t report_page(u8_t usage_page) {
+    return usage_page == USAGE_BUTTON ? USAGE_POINTER : usage_page;
+}
+
+static void hid_listener_batch_press(u8_t usage_page) {
+    batched_press_pages |= BATCHED_PAGE_BIT(usage_page);
+}
+
+static void hid_listener_batch_release(u8_t usage_page) {
+    if (batched_press_pages & BATCHED_PAGE_BIT(usage_page)) {
+        batched_press_pages &= ~BATCHED_PAGE_BIT(usage_page);
+        zmk_endpoints_flush_report(usage_page);
+    }
+}
+
 static int hid_listener_keycode_pressed(u8_t usage_page, u32_t keycode) {
     int err;
     LOG_DBG("usage_page 0x%02X keycode 0x%02X", usage_page, keycode);
@@ -34,15 +59,27 @@ static int hid_listener_keycode_pressed(u8_t usage_page, u32_t keycode) {
             return err;
         }
         break;
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+    case USAGE_BUTTON:
+        err = zmk_hid_pointer_button_press(keycode);
+        if (err) {
+            LOG_ERR("Unable to press button");
+            return err;
+        }
+        break;
+#endif
     }
 
-    return zmk_endpoints_send_report(usage_page);
+    hid_listener_batch_press(report_page(usage_page));
+    return zmk_endpoints_send_report(report_page(usage_page));
 }
 
 static int hid_listener_keycode_released(u8_t usage_page, u32_t keycode) {
     int err;
     LOG_DBG("usage_page 0x%02X keycode 0x%02X", usage_page, keycode);
 
+    hid_listener_batch_release(report_page(usage_page));
+
     switch (usage_page) {
     case USAGE_KEYPAD:
         err = zmk_hid_keypad_release(keycode);
@@ -58,24 +95,45 @@ static int hid_listener_keycode_released(u8_t usage_page, u32_t keycode) {
             return err;
         }
         break;
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+    case USAGE_BUTTON:
+        err = zmk_hid_pointer_button_release(keycode);
+        if (err) {
+            LOG_ERR("Unable to release button");
+            return err;
+        }
+        break;
+#endif
     }
-    return zmk_endpoints_send_report(usage_page);
+    return zmk_endpoints_send_report(report_page(usage_page));
 }
 
 static int hid_listener_modifiers_pressed(zmk_mod_flags modifiers) {
     LOG_DBG("modifiers %d", modifiers);
 
     zmk_hid_register_mods(modifiers);
+    hid_listener_batch_press(USAGE_KEYPAD);
     return zmk_endpoints_send_report(USAGE_KEYPAD);
 }
 
 static int hid_listener_modifiers_released(zmk_mod_flags modifiers) {
     LOG_DBG("modifiers %d", modifiers);
 
+    hid_listener_batch_release(USAGE_KEYPAD);
     zmk_hid_unregister_mods(modifiers);
     return zmk_endpoints_send_report(USAGE_KEYPAD);
 }
 
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+static int hid_listener_pointer_moved(const struct pointer_motion *ev) {
+    LOG_DBG("x %d y %d wheel %d pan %d", ev->x, ev->y, ev->wheel, ev->pan);
+
+    // Motion from any number of events is summed until the next pointer report goes out.
+    zmk_hid_pointer_move(ev->x, ev->y, ev->wheel, ev->pan);
+    return zmk_endpoints_send_report(USAGE_POINTER);
+}
+#endif
+
 int hid_listener(const struct zmk_event_header *eh) {
     if (is_keycode_state_changed(eh)) {
         const struct keycode_state_changed *ev = cast_keycode_state_changed(eh);
@@ -91,10 +149,17 @@ int hid_listener(const struct zmk_event_header *eh) {
         } else {
             hid_listener_modifiers_released(ev->modifiers);
         }
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+    } else if (is_pointer_motion(eh)) {
+        hid_listener_pointer_moved(cast_pointer_motion(eh));
+#endif
     }
     return 0;
 }
 
 ZMK_LISTENER(hid_listener, hid_listener);
-ZMK_SUBSCRIPTION(hid_listener, keycode_state_changed);
-ZMK_SUBSCRIPTION(hid_listener, modifiers_state_changed);
\ No newline at end of file
+ZMK_SUBSCRIPTION_PRIORITY(hid_listener, keycode_state_changed, ZMK_EV_PRIORITY_OUTPUT);
+ZMK_SUBSCRIPTION_PRIORITY(hid_listener, modifiers_state_changed, ZMK_EV_PRIORITY_OUTPUT);
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+ZMK_SUBSCRIPTION_PRIORITY(hid_listener, pointer_motion, ZMK_EV_PRIORITY_OUTPUT);
+#endif
\ No newline at end of file
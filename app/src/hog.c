@@ -4,6 +4,7 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <init.h>
 #include <settings/settings.h>
 
 #include <logging/log.h>
@@ -11,12 +12,21 @@
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
 #include <bluetooth/bluetooth.h>
+#include <bluetooth/conn.h>
 #include <bluetooth/gatt.h>
 
 #include <zmk/ble.h>
 #include <zmk/hog.h>
 #include <zmk/hid.h>
 
+#ifndef BT_UUID_HIDS_BOOT_KB_IN_REPORT
+#define BT_UUID_HIDS_BOOT_KB_IN_REPORT BT_UUID_DECLARE_16(0x2a22)
+#endif
+
+#ifndef BT_UUID_HIDS_BOOT_KB_OUT_REPORT
+#define BT_UUID_HIDS_BOOT_KB_OUT_REPORT BT_UUID_DECLARE_16(0x2a32)
+#endif
+
 enum {
     HIDS_REMOTE_WAKE = BIT(0),
     HIDS_NORMALLY_CONNECTABLE = BIT(1),
@@ -55,9 +65,17 @@ static struct hids_report consumer_input = {
     .type = HIDS_INPUT,
 };
 
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+static struct hids_report pointer_input = {
+    .id = 0x03,
+    .type = HIDS_INPUT,
+};
+#endif
+
 static bool host_requests_notification = false;
 static u8_t ctrl_point;
-// static u8_t proto_mode;
+static u8_t proto_mode = ZMK_HID_PROTOCOL_REPORT;
+static u8_t boot_output_report;
 
 static ssize_t read_hids_info(struct bt_conn *conn, const struct bt_gatt_attr *attr, void *buf,
                               u16_t len, u16_t offset) {
@@ -92,14 +110,67 @@ static ssize_t read_hids_consumer_input_report(struct bt_conn *conn,
                              sizeof(struct zmk_hid_consumer_report_body));
 }
 
-// static ssize_t write_proto_mode(struct bt_conn *conn,
-//                                 const struct bt_gatt_attr *attr,
-//                                 const void *buf, u16_t len, u16_t offset,
-//                                 u8_t flags)
-// {
-//     printk("PROTO CHANGED\n");
-//     return 0;
-// }
+static ssize_t read_hids_boot_input_report(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                                           void *buf, u16_t len, u16_t offset) {
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, zmk_hid_get_boot_report(),
+                             sizeof(struct zmk_hid_boot_report));
+}
+
+static ssize_t read_u8(struct bt_conn *conn, const struct bt_gatt_attr *attr, void *buf, u16_t len,
+                       u16_t offset) {
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, attr->user_data, sizeof(u8_t));
+}
+
+static ssize_t write_proto_mode(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                                const void *buf, u16_t len, u16_t offset, u8_t flags) {
+    u8_t value;
+
+    if (offset != 0 || len != sizeof(value)) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+
+    value = *(u8_t *)buf;
+    if (value != ZMK_HID_PROTOCOL_BOOT && value != ZMK_HID_PROTOCOL_REPORT) {
+        return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+    }
+
+    LOG_DBG("Host selected %s protocol", value == ZMK_HID_PROTOCOL_BOOT ? "boot" : "report");
+    proto_mode = value;
+
+    return len;
+}
+
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+static ssize_t read_hids_pointer_input_report(struct bt_conn *conn,
+                                              const struct bt_gatt_attr *attr, void *buf,
+                                              u16_t len, u16_t offset) {
+    struct zmk_hid_pointer_report_body *report_body = &zmk_hid_get_pointer_report()->body;
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, report_body,
+                             sizeof(struct zmk_hid_pointer_report_body));
+}
+
+#define POINTER_REPORT_ATTRS                                                                       \
+    ,BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_REPORT, BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY,          \
+                            BT_GATT_PERM_READ_ENCRYPT, read_hids_pointer_input_report, NULL,       \
+                            NULL),                                                                 \
+        BT_GATT_CCC(input_ccc_changed, BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT),    \
+        BT_GATT_DESCRIPTOR(BT_UUID_HIDS_REPORT_REF, BT_GATT_PERM_READ, read_hids_report_ref, NULL, \
+                           &pointer_input)
+#else
+#define POINTER_REPORT_ATTRS
+#endif
+
+// LED state from hosts in boot protocol, accepted but not used yet.
+static ssize_t write_boot_output_report(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                                        const void *buf, u16_t len, u16_t offset, u8_t flags) {
+    if (offset != 0 || len != sizeof(boot_output_report)) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+
+    boot_output_report = *(u8_t *)buf;
+
+    return len;
+}
 
 static void input_ccc_changed(const struct bt_gatt_attr *attr, u16_t value) {
     host_requests_notification = (value == BT_GATT_CCC_NOTIFY) ? 1 : 0;
@@ -121,8 +192,6 @@ static ssize_t write_ctrl_point(struct bt_conn *conn, const struct bt_gatt_attr
 /* HID Service Declaration */
 BT_GATT_SERVICE_DEFINE(
     hog_svc, BT_GATT_PRIMARY_SERVICE(BT_UUID_HIDS),
-    //    BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_PROTOCOL_MODE, BT_GATT_CHRC_WRITE_WITHOUT_RESP,
-    //                           BT_GATT_PERM_WRITE, NULL, write_proto_mode, &proto_mode),
     BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_INFO, BT_GATT_CHRC_READ, BT_GATT_PERM_READ, read_hids_info,
                            NULL, &info),
     BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_REPORT_MAP, BT_GATT_CHRC_READ, BT_GATT_PERM_READ,
@@ -139,7 +208,22 @@ BT_GATT_SERVICE_DEFINE(
     BT_GATT_DESCRIPTOR(BT_UUID_HIDS_REPORT_REF, BT_GATT_PERM_READ, read_hids_report_ref, NULL,
                        &consumer_input),
     BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_CTRL_POINT, BT_GATT_CHRC_WRITE_WITHOUT_RESP,
-                           BT_GATT_PERM_WRITE, NULL, write_ctrl_point, &ctrl_point));
+                           BT_GATT_PERM_WRITE, NULL, write_ctrl_point, &ctrl_point),
+
+    // Added after the report characteristics so their attribute indexes stay the same.
+    BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_PROTOCOL_MODE,
+                           BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE_WITHOUT_RESP,
+                           BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT, read_u8,
+                           write_proto_mode, &proto_mode),
+    BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_BOOT_KB_IN_REPORT, BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY,
+                           BT_GATT_PERM_READ_ENCRYPT, read_hids_boot_input_report, NULL, NULL),
+    BT_GATT_CCC(input_ccc_changed, BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT),
+    BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_BOOT_KB_OUT_REPORT,
+                           BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE |
+                               BT_GATT_CHRC_WRITE_WITHOUT_RESP,
+                           BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT, read_u8,
+                           write_boot_output_report, &boot_output_report)
+        POINTER_REPORT_ATTRS);
 
 struct bt_conn *destination_connection() {
     struct bt_conn *conn;
@@ -177,3 +261,58 @@ int zmk_hog_send_consumer_report(struct zmk_hid_consumer_report_body *report) {
     return bt_gatt_notify(conn, &hog_svc.attrs[10], report,
                           sizeof(struct zmk_hid_consumer_report_body));
 };
+
+int zmk_hog_send_boot_report(struct zmk_hid_boot_report *report) {
+    struct bt_conn *conn = destination_connection();
+    if (conn == NULL) {
+        return -ENOTCONN;
+    }
+
+    return bt_gatt_notify(conn, &hog_svc.attrs[18], report, sizeof(struct zmk_hid_boot_report));
+};
+
+u8_t zmk_hog_get_protocol() { return proto_mode; }
+
+// The protocol mode only lasts for a connection, so each host starts in report protocol. Split
+// peripherals, where this side is the central, don't use the service and are left out.
+static void reset_proto_mode(struct bt_conn *conn) {
+    struct bt_conn_info info;
+
+    if (bt_conn_get_info(conn, &info) || info.role != BT_CONN_ROLE_SLAVE) {
+        return;
+    }
+
+    proto_mode = ZMK_HID_PROTOCOL_REPORT;
+}
+
+static void hog_connected(struct bt_conn *conn, u8_t err) {
+    if (!err) {
+        reset_proto_mode(conn);
+    }
+}
+
+static void hog_disconnected(struct bt_conn *conn, u8_t reason) { reset_proto_mode(conn); }
+
+static struct bt_conn_cb hog_conn_callbacks = {
+    .connected = hog_connected,
+    .disconnected = hog_disconnected,
+};
+
+static int zmk_hog_init(struct device *_arg) {
+    bt_conn_cb_register(&hog_conn_callbacks);
+    return 0;
+}
+
+SYS_INIT(zmk_hog_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+int zmk_hog_send_pointer_report(struct zmk_hid_pointer_report_body *report) {
+    struct bt_conn *conn = destination_connection();
+    if (conn == NULL) {
+        return -ENOTCONN;
+    }
+
+    return bt_gatt_notify(conn, &hog_svc.attrs[23], report,
+                          sizeof(struct zmk_hid_pointer_report_body));
+};
+#endif
@@ -4,7 +4,12 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/util.h>
+#include <init.h>
+#include <settings/settings.h>
 #include <logging/log.h>
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
@@ -12,14 +17,15 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 #include <zmk/sensors.h>
 #include <zmk/keymap.h>
 #include <dt-bindings/zmk/matrix-transform.h>
+#include <dt-bindings/zmk/keys.h>
 #include <drivers/behavior.h>
 #include <zmk/behavior.h>
 
 #include <zmk/event-manager.h>
 #include <zmk/events/position-state-changed.h>
 #include <zmk/events/sensor-event.h>
+#include <zmk/events/layer-state-changed.h>
 
-static u32_t zmk_keymap_layer_state = 0;
 static u8_t zmk_keymap_layer_default = 0;
 
 #define DT_DRV_COMPAT zmk_keymap
@@ -30,64 +36,598 @@ static u8_t zmk_keymap_layer_default = 0;
 
 #define LAYER_NODE(l) DT_PHANDLE_BY_IDX(ZMK_KEYMAP_NODE, layers, l)
 
-#define _TRANSFORM_ENTRY(idx, layer)                                                               \
+#define _BINDING_PARAM(layer, prop, idx, cell)                                                     \
+    COND_CODE_0(DT_PHA_HAS_CELL_AT_IDX(layer, prop, idx, cell), (0),                               \
+                (DT_PHA_BY_IDX(layer, prop, idx, cell)))
+
+// Transparent bindings are left out of the table; a position with no entry falls through.
+#define _KEYMAP_ENTRY(layer, prop, idx)                                                            \
+    COND_CODE_1(DT_NODE_HAS_COMPAT(DT_PHANDLE_BY_IDX(layer, prop, idx), zmk_behavior_transparent), \
+                (),                                                                                \
+                ({                                                                                 \
+                     .behavior_dev = DT_LABEL(DT_PHANDLE_BY_IDX(layer, prop, idx)),                \
+                     .param1 = _BINDING_PARAM(layer, prop, idx, param1),                           \
+                     .param2 = _BINDING_PARAM(layer, prop, idx, param2),                           \
+                     .position = idx,                                                              \
+                 },))
+
+// The mouse keys behaviors are always defined, but only work when pointer reports are enabled.
+#define _IS_POINTER_BINDING(behavior)                                                              \
+    (DT_NODE_HAS_COMPAT(behavior, zmk_behavior_mouse_move) ||                                      \
+     DT_PROP_OR(behavior, usage_page, 0) == USAGE_BUTTON)
+
+#define _ASSERT_ENTRY_PARAMS(layer, prop, idx)                                                     \
+    BUILD_ASSERT(_BINDING_PARAM(layer, prop, idx, param1) <= UINT16_MAX &&                         \
+                     _BINDING_PARAM(layer, prop, idx, param2) <= UINT16_MAX,                       \
+                 "Keymap binding parameters must fit in 16 bits");                                 \
+    BUILD_ASSERT(IS_ENABLED(CONFIG_ZMK_HID_POINTER) ||                                             \
+                     !_IS_POINTER_BINDING(DT_PHANDLE_BY_IDX(layer, prop, idx)),                    \
+                 "Mouse keys bindings need CONFIG_ZMK_HID_POINTER=y");
+
+// Each layer gets a const array of its non-transparent entries, sorted by position, and a RAM
+// array holding the behavior device resolved for each of those entries at init.
+#define _KEYMAP_LAYER_ARRAYS(node, prop, name, transform, assert)                                  \
+    UTIL_LISTIFY(DT_PROP_LEN(node, prop), assert, node)                                            \
+    static const struct zmk_keymap_entry UTIL_CAT(node, name)[] = {                                \
+        UTIL_LISTIFY(DT_PROP_LEN(node, prop), transform, node)};                                   \
+    static struct device *UTIL_CAT(node, name##_behaviors)[ARRAY_SIZE(UTIL_CAT(node, name))];
+
+#define _KEYMAP_LAYER(node, name)                                                                  \
     {                                                                                              \
-        .behavior_dev = DT_LABEL(DT_PHANDLE_BY_IDX(layer, bindings, idx)),                         \
-        .param1 = COND_CODE_0(DT_PHA_HAS_CELL_AT_IDX(layer, bindings, idx, param1), (0),           \
-                              (DT_PHA_BY_IDX(layer, bindings, idx, param1))),                      \
-        .param2 = COND_CODE_0(DT_PHA_HAS_CELL_AT_IDX(layer, bindings, idx, param2), (0),           \
-                              (DT_PHA_BY_IDX(layer, bindings, idx, param2))),                      \
+        .entries = UTIL_CAT(node, name), .behaviors = UTIL_CAT(node, name##_behaviors),            \
+        .len = ARRAY_SIZE(UTIL_CAT(node, name)),                                                   \
     },
 
-#define TRANSFORMED_LAYER(node) {UTIL_LISTIFY(DT_PROP_LEN(node, bindings), _TRANSFORM_ENTRY, node)},
+#define _TRANSFORM_ENTRY(idx, layer) _KEYMAP_ENTRY(layer, bindings, idx)
+#define _ASSERT_ENTRY(idx, layer) _ASSERT_ENTRY_PARAMS(layer, bindings, idx)
 
-#if ZMK_KEYMAP_HAS_SENSORS
-#define _TRANSFORM_SENSOR_ENTRY(idx, layer)                                                        \
-    {                                                                                              \
-        .behavior_dev = DT_LABEL(DT_PHANDLE_BY_IDX(layer, sensor_bindings, idx)),                  \
-        .param1 = COND_CODE_0(DT_PHA_HAS_CELL_AT_IDX(layer, sensor_bindings, idx, param1), (0),    \
-                              (DT_PHA_BY_IDX(layer, sensor_bindings, idx, param1))),               \
-        .param2 = COND_CODE_0(DT_PHA_HAS_CELL_AT_IDX(layer, sensor_bindings, idx, param2), (0),    \
-                              (DT_PHA_BY_IDX(layer, sensor_bindings, idx, param2))),               \
-    },
+#define TRANSFORMED_LAYER_ARRAYS(node)                                                             \
+    _KEYMAP_LAYER_ARRAYS(node, bindings, _keymap_entries, _TRANSFORM_ENTRY, _ASSERT_ENTRY)
+#define TRANSFORMED_LAYER(node) _KEYMAP_LAYER(node, _keymap_entries)
 
-#define SENSOR_LAYER(node)                                                                         \
-    COND_CODE_1(                                                                                   \
-        DT_NODE_HAS_PROP(node, sensor_bindings),                                                   \
-        ({UTIL_LISTIFY(DT_PROP_LEN(node, sensor_bindings), _TRANSFORM_SENSOR_ENTRY, node)}),       \
-        ({})),
+#if ZMK_KEYMAP_HAS_SENSORS
+#define _TRANSFORM_SENSOR_ENTRY(idx, layer) _KEYMAP_ENTRY(layer, sensor_bindings, idx)
+#define _ASSERT_SENSOR_ENTRY(idx, layer) _ASSERT_ENTRY_PARAMS(layer, sensor_bindings, idx)
+
+#define SENSOR_LAYER_ARRAYS(node)                                                                  \
+    COND_CODE_1(DT_NODE_HAS_PROP(node, sensor_bindings),                                           \
+                (_KEYMAP_LAYER_ARRAYS(node, sensor_bindings, _sensor_keymap_entries,               \
+                                      _TRANSFORM_SENSOR_ENTRY, _ASSERT_SENSOR_ENTRY)),             \
+                (static const struct zmk_keymap_entry UTIL_CAT(node, _sensor_keymap_entries)[] =   \
+                     {};                                                                           \
+                 static struct device *UTIL_CAT(node, _sensor_keymap_entries_behaviors)[0];))
+#define SENSOR_LAYER(node) _KEYMAP_LAYER(node, _sensor_keymap_entries)
 
 #endif /* ZMK_KEYMAP_HAS_SENSORS */
 
+struct zmk_keymap_entry {
+    const char *behavior_dev;
+    u16_t param1;
+    u16_t param2;
+    u16_t position;
+};
+
+struct zmk_keymap_layer {
+    const struct zmk_keymap_entry *entries;
+    struct device **behaviors;
+    u16_t len;
+};
+
+#define ZMK_KEYMAP_NO_ENTRY UINT16_MAX
+// Set in an entry index that refers to zmk_keymap_overrides rather than to the layer's entries.
+#define ZMK_KEYMAP_OVERRIDE_INDEX 0x8000
+
 // State
 
+#define ZMK_KEYMAP_LAYER_STATE_WORDS DIV_ROUND_UP(ZMK_KEYMAP_LAYERS_LEN, 32)
+
+// Bitset with one bit per layer, sized for the layers the keymap defines.
+struct zmk_keymap_layer_state {
+    u32_t words[ZMK_KEYMAP_LAYER_STATE_WORDS];
+};
+
+static struct zmk_keymap_layer_state zmk_keymap_layer_state;
+
 // When a behavior handles a key position "down" event, we record the layer state
 // here so that even if that layer is deactivated before the "up", event, we
 // still send the release event to the behavior in that layer also.
-static u32_t zmk_keymap_active_behavior_layer[ZMK_KEYMAP_LEN];
+static struct zmk_keymap_layer_state zmk_keymap_active_behavior_layer[ZMK_KEYMAP_LEN];
+
+DT_INST_FOREACH_CHILD(0, TRANSFORMED_LAYER_ARRAYS)
 
-static struct zmk_behavior_binding zmk_keymap[ZMK_KEYMAP_LAYERS_LEN][ZMK_KEYMAP_LEN] = {
+static const struct zmk_keymap_layer zmk_keymap[ZMK_KEYMAP_LAYERS_LEN] = {
     DT_INST_FOREACH_CHILD(0, TRANSFORMED_LAYER)};
 
 #if ZMK_KEYMAP_HAS_SENSORS
 
-static struct zmk_behavior_binding zmk_sensor_keymap[ZMK_KEYMAP_LAYERS_LEN]
-                                                    [ZMK_KEYMAP_SENSORS_LEN] = {
-                                                        DT_INST_FOREACH_CHILD(0, SENSOR_LAYER)};
+DT_INST_FOREACH_CHILD(0, SENSOR_LAYER_ARRAYS)
+
+static const struct zmk_keymap_layer zmk_sensor_keymap[ZMK_KEYMAP_LAYERS_LEN] = {
+    DT_INST_FOREACH_CHILD(0, SENSOR_LAYER)};
 
 #endif /* ZMK_KEYMAP_HAS_SENSORS */
 
+// For each position, the highest layer active in zmk_keymap_layer_state with a resolved binding,
+// and the index of that binding in the layer's entries. Rebuilt whenever the layer state
+// changes, so a press skips the layer walk.
+static u8_t zmk_keymap_effective_layer[ZMK_KEYMAP_LEN];
+static u16_t zmk_keymap_effective_entry[ZMK_KEYMAP_LEN];
+
+// Index of the entry for position in layer, or ZMK_KEYMAP_NO_ENTRY if it is transparent there.
+static u16_t zmk_keymap_find_entry(const struct zmk_keymap_layer *layer, u32_t position) {
+    int low = 0;
+    int high = layer->len - 1;
+
+    while (low <= high) {
+        int mid = (low + high) / 2;
+
+        if (layer->entries[mid].position == position) {
+            return mid;
+        } else if (layer->entries[mid].position < position) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+
+    return ZMK_KEYMAP_NO_ENTRY;
+}
+
+#if IS_ENABLED(CONFIG_ZMK_KEYMAP_OVERRIDES)
+
+// Bindings replaced at runtime. Each one takes precedence over the compiled binding for the
+// same layer and position, and is persisted through the settings subsystem.
+struct zmk_keymap_override {
+    struct zmk_keymap_entry entry;
+    struct device *behavior;
+    u8_t layer;
+};
+
+static struct zmk_keymap_override zmk_keymap_overrides[CONFIG_ZMK_KEYMAP_OVERRIDES_MAX];
+static u8_t zmk_keymap_overrides_len;
+
+// Overrides may be changed from any thread, so changes and position events are serialized. A
+// position can't be changed while it is held, so its release reaches the binding it pressed.
+static K_MUTEX_DEFINE(zmk_keymap_mutex);
+static u32_t zmk_keymap_pressed_positions[DIV_ROUND_UP(ZMK_KEYMAP_LEN, 32)];
+
+#define KEYMAP_LOCK() k_mutex_lock(&zmk_keymap_mutex, K_FOREVER)
+#define KEYMAP_UNLOCK() k_mutex_unlock(&zmk_keymap_mutex)
+
+static bool zmk_keymap_position_pressed(u32_t position) {
+    return (zmk_keymap_pressed_positions[position / 32] & BIT(position % 32)) != 0;
+}
+
+static void zmk_keymap_set_position_pressed(u32_t position, bool pressed) {
+    WRITE_BIT(zmk_keymap_pressed_positions[position / 32], position % 32, pressed);
+}
+
+static int zmk_keymap_find_override(u8_t layer, u32_t position) {
+    for (int i = 0; i < zmk_keymap_overrides_len; i++) {
+        if (zmk_keymap_overrides[i].layer == layer &&
+            zmk_keymap_overrides[i].entry.position == position) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+#endif /* IS_ENABLED(CONFIG_ZMK_KEYMAP_OVERRIDES) */
+
+static u16_t zmk_keymap_find_binding(u8_t layer, u32_t position) {
+#if IS_ENABLED(CONFIG_ZMK_KEYMAP_OVERRIDES)
+    int override = zmk_keymap_find_override(layer, position);
+
+    if (override >= 0) {
+        return ZMK_KEYMAP_OVERRIDE_INDEX | override;
+    }
+#endif /* IS_ENABLED(CONFIG_ZMK_KEYMAP_OVERRIDES) */
+
+    return zmk_keymap_find_entry(&zmk_keymap[layer], position);
+}
+
+static bool layer_state_equal(const struct zmk_keymap_layer_state *a,
+                              const struct zmk_keymap_layer_state *b) {
+    return memcmp(a->words, b->words, sizeof(a->words)) == 0;
+}
+
+// Highest layer at or below max_layer that is set in state, or -1 if there is none.
+static int layer_state_highest(const struct zmk_keymap_layer_state *state, int max_layer) {
+    int word = max_layer / 32;
+    u32_t bits = state->words[word] & (0xFFFFFFFF >> (31 - (max_layer % 32)));
+
+    while (bits == 0) {
+        if (--word < 0) {
+            return -1;
+        }
+        bits = state->words[word];
+    }
+
+    return word * 32 + 31 - __builtin_clz(bits);
+}
+
+// Highest layer at or below the given one that is either active in state or the default layer.
+// Returns -1 once the walk has gone below the default layer.
+static int next_active_layer(const struct zmk_keymap_layer_state *state, int layer) {
+    if (layer < zmk_keymap_layer_default) {
+        return -1;
+    }
+
+    return MAX(layer_state_highest(state, layer), zmk_keymap_layer_default);
+}
+
+static void zmk_keymap_update_effective_layers() {
+    for (int position = 0; position < ZMK_KEYMAP_LEN; position++) {
+        zmk_keymap_effective_layer[position] = zmk_keymap_layer_default;
+        zmk_keymap_effective_entry[position] = ZMK_KEYMAP_NO_ENTRY;
+    }
+
+    // Walk the active layers from the top, so the first entry seen for a position wins.
+    for (int layer = next_active_layer(&zmk_keymap_layer_state, ZMK_KEYMAP_LAYERS_LEN - 1);
+         layer >= 0; layer = next_active_layer(&zmk_keymap_layer_state, layer - 1)) {
+        const struct zmk_keymap_layer *keymap_layer = &zmk_keymap[layer];
+
+#if IS_ENABLED(CONFIG_ZMK_KEYMAP_OVERRIDES)
+        for (int i = 0; i < zmk_keymap_overrides_len; i++) {
+            u16_t position = zmk_keymap_overrides[i].entry.position;
+
+            if (zmk_keymap_overrides[i].layer == layer &&
+                zmk_keymap_effective_entry[position] == ZMK_KEYMAP_NO_ENTRY) {
+                zmk_keymap_effective_layer[position] = layer;
+                zmk_keymap_effective_entry[position] = ZMK_KEYMAP_OVERRIDE_INDEX | i;
+            }
+        }
+#endif /* IS_ENABLED(CONFIG_ZMK_KEYMAP_OVERRIDES) */
+
+        for (int i = 0; i < keymap_layer->len; i++) {
+            u16_t position = keymap_layer->entries[i].position;
+
+            if (zmk_keymap_effective_entry[position] == ZMK_KEYMAP_NO_ENTRY &&
+                keymap_layer->behaviors[i] != NULL) {
+                zmk_keymap_effective_layer[position] = layer;
+                zmk_keymap_effective_entry[position] = i;
+            }
+        }
+    }
+}
+
+static int raise_layer_state_changed(u8_t layer, bool state) {
+    struct layer_state_changed *ev = new_layer_state_changed();
+
+    if (ev == NULL) {
+        return -ENOMEM;
+    }
+
+    LOG_DBG("layer: %d state: %d", layer, state);
+
+    ev->layer = layer;
+    ev->state = state;
+
+    return ZMK_EVENT_RAISE(ev);
+}
+
+#if CONFIG_ZMK_LAYER_STATE_CHANGED_DELAY > 0
+
+// Layer state as last reported through layer_state_changed events.
+static struct zmk_keymap_layer_state zmk_keymap_reported_layer_state;
+static struct k_delayed_work layer_state_changed_work;
+static atomic_t layer_state_changed_scheduled;
+
+static void layer_state_changed_work_handler(struct k_work *work) {
+    atomic_set(&layer_state_changed_scheduled, false);
+
+    for (int word = 0; word < ZMK_KEYMAP_LAYER_STATE_WORDS; word++) {
+        u32_t changed =
+            zmk_keymap_layer_state.words[word] ^ zmk_keymap_reported_layer_state.words[word];
+
+        while (changed) {
+            int bit = __builtin_ctz(changed);
+            bool state = (zmk_keymap_layer_state.words[word] & BIT(bit)) != 0;
+
+            changed &= ~BIT(bit);
+            WRITE_BIT(zmk_keymap_reported_layer_state.words[word], bit, state);
+            raise_layer_state_changed(word * 32 + bit, state);
+        }
+    }
+}
+
+#endif /* CONFIG_ZMK_LAYER_STATE_CHANGED_DELAY > 0 */
+
+static void zmk_keymap_layer_state_changed(u8_t layer, bool state) {
+    zmk_keymap_update_effective_layers();
+
+#if CONFIG_ZMK_LAYER_STATE_CHANGED_DELAY > 0
+    // Changes made while the work is scheduled don't push it back, so the delay is the longest a
+    // change waits to be reported even while layers keep changing.
+    if (atomic_cas(&layer_state_changed_scheduled, false, true)) {
+        k_delayed_work_submit(&layer_state_changed_work,
+                              K_MSEC(CONFIG_ZMK_LAYER_STATE_CHANGED_DELAY));
+    }
+#else
+    raise_layer_state_changed(layer, state);
+#endif
+}
+
+#if IS_ENABLED(CONFIG_ZMK_KEYMAP_OVERRIDES)
+
+#define ZMK_KEYMAP_OVERRIDE_LABEL_MAX 32
+
+// Settings value stored under keymap/<layer>/<position>. Only the label's characters are
+// written, without padding or a terminator.
+struct zmk_keymap_override_record {
+    u16_t param1;
+    u16_t param2;
+    char behavior_dev[ZMK_KEYMAP_OVERRIDE_LABEL_MAX];
+} __packed;
+
+static int zmk_keymap_set_override(u8_t layer, u32_t position, struct device *behavior,
+                                   u16_t param1, u16_t param2) {
+    int index = zmk_keymap_find_override(layer, position);
+
+    if (index < 0) {
+        if (zmk_keymap_overrides_len >= CONFIG_ZMK_KEYMAP_OVERRIDES_MAX) {
+            return -ENOMEM;
+        }
+
+        index = zmk_keymap_overrides_len++;
+    }
+
+    zmk_keymap_overrides[index] = (struct zmk_keymap_override){
+        .entry =
+            {
+                .behavior_dev = behavior->name,
+                .param1 = param1,
+                .param2 = param2,
+                .position = position,
+            },
+        .behavior = behavior,
+        .layer = layer,
+    };
+
+    return 0;
+}
+
+static void zmk_keymap_remove_override(u8_t layer, u32_t position) {
+    int index = zmk_keymap_find_override(layer, position);
+
+    if (index >= 0) {
+        zmk_keymap_overrides[index] = zmk_keymap_overrides[--zmk_keymap_overrides_len];
+    }
+}
+
+static int keymap_handle_set(const char *name, size_t len, settings_read_cb read_cb,
+                             void *cb_arg) {
+    struct zmk_keymap_override_record record;
+    char *endptr;
+    u8_t layer;
+    u32_t position;
+    int err;
+
+    layer = strtoul(name, &endptr, 10);
+    if (*endptr != '/') {
+        LOG_WRN("Invalid keymap setting: %s", log_strdup(name));
+        return -EINVAL;
+    }
+
+    position = strtoul(endptr + 1, &endptr, 10);
+    if (*endptr != '\0' || layer >= ZMK_KEYMAP_LAYERS_LEN || position >= ZMK_KEYMAP_LEN) {
+        LOG_WRN("Invalid keymap setting: %s", log_strdup(name));
+        return -EINVAL;
+    }
+
+    if (len == 0) {
+        zmk_keymap_remove_override(layer, position);
+        return 0;
+    }
+
+    if (len <= offsetof(struct zmk_keymap_override_record, behavior_dev) ||
+        len >= sizeof(record)) {
+        LOG_ERR("Invalid keymap override size (got %d)", len);
+        return -EINVAL;
+    }
+
+    err = read_cb(cb_arg, &record, len);
+    if (err <= 0) {
+        LOG_ERR("Failed to handle keymap override from settings (err %d)", err);
+        return err;
+    }
+
+    record.behavior_dev[len - offsetof(struct zmk_keymap_override_record, behavior_dev)] = '\0';
+
+    struct device *behavior = device_get_binding(record.behavior_dev);
+    if (behavior == NULL) {
+        LOG_WRN("Unknown behavior %s for keymap override", log_strdup(record.behavior_dev));
+        return -ENODEV;
+    }
+
+    err = zmk_keymap_set_override(layer, position, behavior, record.param1, record.param2);
+    if (err) {
+        LOG_WRN("Too many keymap overrides, ignoring %s", log_strdup(name));
+    }
+
+    return err;
+}
+
+static int keymap_handle_commit() {
+    zmk_keymap_update_effective_layers();
+    return 0;
+}
+
+struct settings_handler keymap_settings_handler = {
+    .name = "keymap", .h_set = keymap_handle_set, .h_commit = keymap_handle_commit};
+
+// Formats the settings name of an override, keymap/<layer>/<position>.
+static int zmk_keymap_override_setting_name(char *name, size_t len, u8_t layer, u32_t position) {
+    int ret = snprintf(name, len, "keymap/%d/%d", layer, position);
+
+    if (ret < 0 || (size_t)ret >= len) {
+        return -ENAMETOOLONG;
+    }
+
+    return 0;
+}
+
+int zmk_keymap_override_binding(u8_t layer, u32_t position, const char *behavior_dev,
+                                u32_t param1, u32_t param2) {
+    struct zmk_keymap_override_record record = {.param1 = param1, .param2 = param2};
+    char setting_name[20];
+    size_t label_len = strlen(behavior_dev);
+    struct device *behavior;
+    int err;
+
+    if (layer >= ZMK_KEYMAP_LAYERS_LEN || position >= ZMK_KEYMAP_LEN || param1 > UINT16_MAX ||
+        param2 > UINT16_MAX || label_len >= ZMK_KEYMAP_OVERRIDE_LABEL_MAX) {
+        return -EINVAL;
+    }
+
+    err = zmk_keymap_override_setting_name(setting_name, sizeof(setting_name), layer, position);
+    if (err) {
+        return err;
+    }
+
+    behavior = device_get_binding(behavior_dev);
+    if (behavior == NULL) {
+        return -ENODEV;
+    }
+
+    KEYMAP_LOCK();
+
+    if (zmk_keymap_position_pressed(position)) {
+        KEYMAP_UNLOCK();
+        return -EBUSY;
+    }
+
+    err = zmk_keymap_set_override(layer, position, behavior, param1, param2);
+    if (!err) {
+        zmk_keymap_update_effective_layers();
+    }
+
+    KEYMAP_UNLOCK();
+
+    if (err) {
+        return err;
+    }
+
+    memcpy(record.behavior_dev, behavior_dev, label_len);
+
+    return settings_save_one(setting_name, &record,
+                             offsetof(struct zmk_keymap_override_record, behavior_dev) + label_len);
+}
+
+int zmk_keymap_clear_override(u8_t layer, u32_t position) {
+    char setting_name[20];
+    int err;
+
+    if (layer >= ZMK_KEYMAP_LAYERS_LEN || position >= ZMK_KEYMAP_LEN) {
+        return -EINVAL;
+    }
+
+    err = zmk_keymap_override_setting_name(setting_name, sizeof(setting_name), layer, position);
+    if (err) {
+        return err;
+    }
+
+    KEYMAP_LOCK();
+
+    if (zmk_keymap_find_override(layer, position) < 0) {
+        KEYMAP_UNLOCK();
+        return -ENOENT;
+    }
+
+    if (zmk_keymap_position_pressed(position)) {
+        KEYMAP_UNLOCK();
+        return -EBUSY;
+    }
+
+    zmk_keymap_remove_override(layer, position);
+    zmk_keymap_update_effective_layers();
+
+    KEYMAP_UNLOCK();
+
+    return settings_delete(setting_name);
+}
+
+int zmk_keymap_reload_overrides() {
+    int err;
+
+    KEYMAP_LOCK();
+
+    for (int i = 0; i < ARRAY_SIZE(zmk_keymap_pressed_positions); i++) {
+        if (zmk_keymap_pressed_positions[i] != 0) {
+            KEYMAP_UNLOCK();
+            return -EBUSY;
+        }
+    }
+
+    zmk_keymap_overrides_len = 0;
+    // The commit handler rebuilds the effective layers once everything is loaded.
+    err = settings_load_subtree("keymap");
+
+    KEYMAP_UNLOCK();
+    return err;
+}
+
+#endif /* IS_ENABLED(CONFIG_ZMK_KEYMAP_OVERRIDES) */
+
+static void zmk_keymap_resolve_behaviors(const struct zmk_keymap_layer *layer) {
+    for (int i = 0; i < layer->len; i++) {
+        layer->behaviors[i] = device_get_binding(layer->entries[i].behavior_dev);
+    }
+}
+
+static int zmk_keymap_init(struct device *_arg) {
+    for (int layer = 0; layer < ZMK_KEYMAP_LAYERS_LEN; layer++) {
+        zmk_keymap_resolve_behaviors(&zmk_keymap[layer]);
+#if ZMK_KEYMAP_HAS_SENSORS
+        zmk_keymap_resolve_behaviors(&zmk_sensor_keymap[layer]);
+#endif /* ZMK_KEYMAP_HAS_SENSORS */
+    }
+
+#if IS_ENABLED(CONFIG_ZMK_KEYMAP_OVERRIDES)
+    settings_subsys_init();
+
+    int err = settings_register(&keymap_settings_handler);
+    if (err) {
+        LOG_ERR("Failed to setup the keymap settings handler (err %d)", err);
+    } else {
+        settings_load_subtree("keymap");
+    }
+#endif /* IS_ENABLED(CONFIG_ZMK_KEYMAP_OVERRIDES) */
+
+    zmk_keymap_update_effective_layers();
+
+#if CONFIG_ZMK_LAYER_STATE_CHANGED_DELAY > 0
+    k_delayed_work_init(&layer_state_changed_work, layer_state_changed_work_handler);
+#endif
+
+    return 0;
+}
+
+SYS_INIT(zmk_keymap_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+
 #define SET_LAYER_STATE(layer, state)                                                              \
-    if (layer >= 32) {                                                                             \
+    if (layer >= ZMK_KEYMAP_LAYERS_LEN) {                                                          \
         return -EINVAL;                                                                            \
     }                                                                                              \
-    WRITE_BIT(zmk_keymap_layer_state, layer, state);                                               \
+    if (zmk_keymap_layer_active(layer) != state) {                                                 \
+        WRITE_BIT(zmk_keymap_layer_state.words[layer / 32], layer % 32, state);                    \
+        zmk_keymap_layer_state_changed(layer, state);                                              \
+    }                                                                                              \
     return 0;
 
 bool zmk_keymap_layer_active(u8_t layer) {
-    return (zmk_keymap_layer_state & (BIT(layer))) == (BIT(layer));
+    if (layer >= ZMK_KEYMAP_LAYERS_LEN) {
+        return false;
+    }
+
+    return (zmk_keymap_layer_state.words[layer / 32] & BIT(layer % 32)) != 0;
 };
 
+u8_t zmk_keymap_highest_layer_active() {
+    return next_active_layer(&zmk_keymap_layer_state, ZMK_KEYMAP_LAYERS_LEN - 1);
+}
+
 int zmk_keymap_layer_activate(u8_t layer) { SET_LAYER_STATE(layer, true); };
 
 int zmk_keymap_layer_deactivate(u8_t layer) { SET_LAYER_STATE(layer, false); };
@@ -100,19 +640,29 @@ int zmk_keymap_layer_toggle(u8_t layer) {
     return zmk_keymap_layer_activate(layer);
 };
 
-bool is_active_layer(u8_t layer, u32_t layer_state) {
-    return (layer_state & BIT(layer)) == BIT(layer) || layer == zmk_keymap_layer_default;
-}
-
-int zmk_keymap_apply_position_state(int layer, u32_t position, bool pressed) {
-    struct zmk_behavior_binding *binding = &zmk_keymap[layer][position];
+static int zmk_keymap_apply_entry(int layer, u16_t index, u32_t position, bool pressed) {
+    const struct zmk_keymap_entry *binding;
     struct device *behavior;
 
+    if (index == ZMK_KEYMAP_NO_ENTRY) {
+        LOG_DBG("layer: %d position: %d is transparent", layer, position);
+        return 1;
+    }
+
+#if IS_ENABLED(CONFIG_ZMK_KEYMAP_OVERRIDES)
+    if (index & ZMK_KEYMAP_OVERRIDE_INDEX) {
+        binding = &zmk_keymap_overrides[index & ~ZMK_KEYMAP_OVERRIDE_INDEX].entry;
+        behavior = zmk_keymap_overrides[index & ~ZMK_KEYMAP_OVERRIDE_INDEX].behavior;
+    } else
+#endif /* IS_ENABLED(CONFIG_ZMK_KEYMAP_OVERRIDES) */
+    {
+        binding = &zmk_keymap[layer].entries[index];
+        behavior = zmk_keymap[layer].behaviors[index];
+    }
+
     LOG_DBG("layer: %d position: %d, binding name: %s", layer, position,
             log_strdup(binding->behavior_dev));
 
-    behavior = device_get_binding(binding->behavior_dev);
-
     if (!behavior) {
         LOG_DBG("No behavior assigned to %d on layer %d", position, layer);
         return 1;
@@ -127,45 +677,88 @@ int zmk_keymap_apply_position_state(int layer, u32_t position, bool pressed) {
     }
 }
 
-int zmk_keymap_position_state_changed(u32_t position, bool pressed) {
-    for (int layer = ZMK_KEYMAP_LAYERS_LEN - 1; layer >= zmk_keymap_layer_default; layer--) {
-        u32_t layer_state =
-            pressed ? zmk_keymap_layer_state : zmk_keymap_active_behavior_layer[position];
-        if (is_active_layer(layer, layer_state)) {
-            int ret = zmk_keymap_apply_position_state(layer, position, pressed);
+int zmk_keymap_apply_position_state(int layer, u32_t position, bool pressed) {
+    return zmk_keymap_apply_entry(layer, zmk_keymap_find_binding(layer, position), position,
+                                  pressed);
+}
 
-            zmk_keymap_active_behavior_layer[position] = zmk_keymap_layer_state;
+static int zmk_keymap_walk_layers(int top_layer, u32_t position, bool pressed, bool cached) {
+    const struct zmk_keymap_layer_state *layer_state =
+        pressed ? &zmk_keymap_layer_state : &zmk_keymap_active_behavior_layer[position];
 
-            if (ret > 0) {
-                LOG_DBG("behavior processing to continue to next layer");
-                continue;
-            } else if (ret < 0) {
-                LOG_DBG("Behavior returned error: %d", ret);
-                return ret;
-            } else {
-                return ret;
-            }
+    for (int layer = next_active_layer(layer_state, top_layer); layer >= 0;
+         layer = next_active_layer(layer_state, layer - 1)) {
+        int ret;
+
+        if (cached) {
+            ret = zmk_keymap_apply_entry(layer, zmk_keymap_effective_entry[position], position,
+                                         pressed);
+            cached = false;
+        } else {
+            ret = zmk_keymap_apply_position_state(layer, position, pressed);
+        }
+
+        zmk_keymap_active_behavior_layer[position] = zmk_keymap_layer_state;
+
+        if (ret > 0) {
+            LOG_DBG("behavior processing to continue to next layer");
+            continue;
+        } else if (ret < 0) {
+            LOG_DBG("Behavior returned error: %d", ret);
+            return ret;
+        } else {
+            return ret;
         }
     }
 
     return -ENOTSUP;
 }
 
+static int zmk_keymap_handle_position(u32_t position, bool pressed) {
+    // The effective layer is only valid for the current layer state. Releases whose press
+    // happened under a different layer state still walk every layer.
+    if (pressed ||
+        layer_state_equal(&zmk_keymap_active_behavior_layer[position], &zmk_keymap_layer_state)) {
+        return zmk_keymap_walk_layers(zmk_keymap_effective_layer[position], position, pressed,
+                                      true);
+    }
+
+    return zmk_keymap_walk_layers(ZMK_KEYMAP_LAYERS_LEN - 1, position, pressed, false);
+}
+
+int zmk_keymap_position_state_changed(u32_t position, bool pressed) {
+#if IS_ENABLED(CONFIG_ZMK_KEYMAP_OVERRIDES)
+    int ret;
+
+    if (position >= ZMK_KEYMAP_LEN) {
+        return -EINVAL;
+    }
+
+    KEYMAP_LOCK();
+    zmk_keymap_set_position_pressed(position, pressed);
+    ret = zmk_keymap_handle_position(position, pressed);
+    KEYMAP_UNLOCK();
+
+    return ret;
+#else
+    return zmk_keymap_handle_position(position, pressed);
+#endif /* IS_ENABLED(CONFIG_ZMK_KEYMAP_OVERRIDES) */
+}
+
 #if ZMK_KEYMAP_HAS_SENSORS
 int zmk_keymap_sensor_triggered(u8_t sensor_number, struct device *sensor) {
-    for (int layer = ZMK_KEYMAP_LAYERS_LEN - 1; layer >= zmk_keymap_layer_default; layer--) {
-        if (((zmk_keymap_layer_state & BIT(layer)) == BIT(layer) ||
-             layer == zmk_keymap_layer_default) &&
-            zmk_sensor_keymap[layer] != NULL) {
-            struct zmk_behavior_binding *binding = &zmk_sensor_keymap[layer][sensor_number];
-            struct device *behavior;
+    for (int layer = next_active_layer(&zmk_keymap_layer_state, ZMK_KEYMAP_LAYERS_LEN - 1);
+         layer >= 0; layer = next_active_layer(&zmk_keymap_layer_state, layer - 1)) {
+        u16_t index = zmk_keymap_find_entry(&zmk_sensor_keymap[layer], sensor_number);
+
+        if (index != ZMK_KEYMAP_NO_ENTRY) {
+            const struct zmk_keymap_entry *binding = &zmk_sensor_keymap[layer].entries[index];
+            struct device *behavior = zmk_sensor_keymap[layer].behaviors[index];
             int ret;
 
             LOG_DBG("layer: %d sensor_number: %d, binding name: %s", layer, sensor_number,
                     log_strdup(binding->behavior_dev));
 
-            behavior = device_get_binding(binding->behavior_dev);
-
             if (!behavior) {
                 LOG_DBG("No behavior assigned to %d on layer %d", sensor_number, layer);
                 continue;
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2020 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#define DT_DRV_COMPAT zmk_keymap_overrides_mock
+
+#include <device.h>
+#include <init.h>
+#include <storage/flash_map.h>
+#include <logging/log.h>
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#include <zmk/keymap.h>
+#include <dt-bindings/zmk/keymap-overrides-mock.h>
+
+#if DT_NODE_EXISTS(DT_DRV_INST(0))
+
+#define MOCK_NODE DT_DRV_INST(0)
+
+struct keymap_overrides_mock_binding {
+    const char *behavior_dev;
+    u32_t param1;
+    u32_t param2;
+};
+
+#define _BINDING_PARAM(idx, cell)                                                                  \
+    COND_CODE_0(DT_PHA_HAS_CELL_AT_IDX(MOCK_NODE, bindings, idx, cell), (0),                       \
+                (DT_PHA_BY_IDX(MOCK_NODE, bindings, idx, cell)))
+
+#define _MOCK_BINDING(idx, _)                                                                      \
+    {                                                                                              \
+        .behavior_dev = DT_LABEL(DT_PHANDLE_BY_IDX(MOCK_NODE, bindings, idx)),                     \
+        .param1 = _BINDING_PARAM(idx, param1), .param2 = _BINDING_PARAM(idx, param2),              \
+    },
+
+static const u32_t events[] = DT_PROP(MOCK_NODE, events);
+static const struct keymap_overrides_mock_binding bindings[] = {
+    COND_CODE_1(DT_NODE_HAS_PROP(MOCK_NODE, bindings),
+                (UTIL_LISTIFY(DT_PROP_LEN(MOCK_NODE, bindings), _MOCK_BINDING, _)), ())};
+
+static u8_t event_index;
+static u8_t binding_index;
+static struct k_delayed_work mock_work;
+
+static void keymap_overrides_mock_schedule_next_event() {
+    if (event_index < ARRAY_SIZE(events)) {
+        k_delayed_work_submit(&mock_work, K_MSEC(ZMK_OVERRIDE_MOCK_MSEC(events[event_index])));
+    }
+}
+
+static void keymap_overrides_mock_apply(u32_t ev) {
+    u8_t layer = ZMK_OVERRIDE_MOCK_LAYER(ev);
+    u8_t position = ZMK_OVERRIDE_MOCK_POS(ev);
+    const struct keymap_overrides_mock_binding *binding;
+
+    switch (ZMK_OVERRIDE_MOCK_OP(ev)) {
+    case ZMK_OVERRIDE_MOCK_OP_SET:
+        if (binding_index >= ARRAY_SIZE(bindings)) {
+            LOG_ERR("No binding left for override of layer %d position %d", layer, position);
+            return;
+        }
+
+        binding = &bindings[binding_index++];
+        LOG_DBG("set layer %d position %d to %s: %d", layer, position, binding->behavior_dev,
+                zmk_keymap_override_binding(layer, position, binding->behavior_dev,
+                                            binding->param1, binding->param2));
+        break;
+    case ZMK_OVERRIDE_MOCK_OP_CLEAR:
+        LOG_DBG("clear layer %d position %d: %d", layer, position,
+                zmk_keymap_clear_override(layer, position));
+        break;
+    case ZMK_OVERRIDE_MOCK_OP_RELOAD:
+        LOG_DBG("reload: %d", zmk_keymap_reload_overrides());
+        break;
+    default:
+        LOG_ERR("Unknown keymap override mock event %u", ev);
+    }
+}
+
+static void keymap_overrides_mock_work_handler(struct k_work *work) {
+    keymap_overrides_mock_apply(events[event_index++]);
+    keymap_overrides_mock_schedule_next_event();
+}
+
+static int keymap_overrides_mock_init(struct device *_arg) {
+    const struct flash_area *fa;
+
+    // The simulated flash is kept in a file, so erase it to start every run without overrides.
+    int err = flash_area_open(FLASH_AREA_ID(storage), &fa);
+    if (!err) {
+        err = flash_area_erase(fa, 0, fa->fa_size);
+        flash_area_close(fa);
+    }
+
+    if (err) {
+        LOG_ERR("Failed to erase the settings storage (err %d)", err);
+    }
+
+    k_delayed_work_init(&mock_work, keymap_overrides_mock_work_handler);
+    keymap_overrides_mock_schedule_next_event();
+    return 0;
+}
+
+SYS_INIT(keymap_overrides_mock_init, APPLICATION, CONFIG_KERNEL_INIT_PRIORITY_DEFAULT);
+
+#endif /* DT_NODE_EXISTS(DT_DRV_INST(0)) */
@@ -14,6 +14,7 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 #include <zmk/matrix_transform.h>
 #include <zmk/event-manager.h>
 #include <zmk/events/position-state-changed.h>
+#include <zmk/endpoints.h>
 
 #define ZMK_KSCAN_EVENT_STATE_PRESSED 0
 #define ZMK_KSCAN_EVENT_STATE_RELEASED 1
@@ -43,6 +44,12 @@ static void zmk_kscan_callback(struct device *dev, u32_t row, u32_t column, bool
 void zmk_kscan_process_msgq(struct k_work *item) {
     struct zmk_kscan_event ev;
 
+    // With deferred dispatch the listeners run later, from the drain pass, and the endpoints
+    // batch the reports they send through the event manager's drain hooks.
+#if !IS_ENABLED(CONFIG_ZMK_EVENT_MANAGER_DEFERRED)
+    zmk_endpoints_batch_begin();
+#endif
+
     while (k_msgq_get(&zmk_kscan_msgq, &ev, K_NO_WAIT) == 0) {
         bool pressed = (ev.state == ZMK_KSCAN_EVENT_STATE_PRESSED);
         u32_t position = zmk_matrix_transform_row_column_to_position(ev.row, ev.column);
@@ -50,10 +57,18 @@ void zmk_kscan_process_msgq(struct k_work *item) {
         LOG_DBG("Row: %d, col: %d, position: %d, pressed: %s\n", ev.row, ev.column, position,
                 (pressed ? "true" : "false"));
         pos_ev = new_position_state_changed();
+        if (pos_ev == NULL) {
+            LOG_ERR("Unable to allocate position state change for %d", position);
+            continue;
+        }
         pos_ev->state = pressed;
         pos_ev->position = position;
-        ZMK_EVENT_RAISE(pos_ev);
+        ZMK_EVENT_RAISE_DEFERRED(pos_ev);
     }
+
+#if !IS_ENABLED(CONFIG_ZMK_EVENT_MANAGER_DEFERRED)
+    zmk_endpoints_batch_end();
+#endif
 }
 
 int zmk_kscan_init(char *name) {
@@ -46,10 +46,13 @@ static void zmk_sensors_trigger_handler(struct device *dev, struct sensor_trigge
     }
 
     event = new_sensor_event();
+    if (event == NULL) {
+        return;
+    }
     event->sensor_number = item->sensor_number;
     event->sensor = dev;
 
-    ZMK_EVENT_RAISE(event);
+    ZMK_EVENT_RAISE_DEFERRED(event);
 }
 
 static void zmk_sensors_init_item(const char *node, u8_t i, u8_t abs_i) {
@@ -58,11 +58,15 @@ static u8_t split_central_notify_func(struct bt_conn *conn, struct bt_gatt_subsc
                 u32_t position = (i * 8) + j;
                 bool pressed = position_state[i] & BIT(j);
                 struct position_state_changed *pos_ev = new_position_state_changed();
+                if (pos_ev == NULL) {
+                    LOG_ERR("Unable to allocate key position state change for %d", position);
+                    continue;
+                }
                 pos_ev->position = position;
                 pos_ev->state = pressed;
 
                 LOG_DBG("Trigger key position state change for %d", position);
-                ZMK_EVENT_RAISE(pos_ev);
+                ZMK_EVENT_RAISE_DEFERRED(pos_ev);
             }
         }
     }
@@ -4,6 +4,7 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <string.h>
 #include <device.h>
 #include <init.h>
 
@@ -13,56 +14,561 @@
 
 #include <zmk/hid.h>
 #include <zmk/keymap.h>
+#include <zmk/endpoints.h>
+#include <zmk/usb_hid.h>
 
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
 static enum usb_dc_status_code usb_status = USB_DC_UNKNOWN;
 
-static struct device *hid_dev;
+static u8_t hid_protocol = ZMK_HID_PROTOCOL_REPORT;
 
-static K_SEM_DEFINE(hid_sem, 1, 1);
+// Reports are handed to the USB stack without waiting for the previous transfer to finish.
+// Each report ID buffers the reports the host has not seen yet. A new report replaces the latest
+// buffered one only if the host misses no press or release by skipping it, so e.g. a tap within
+// one poll interval still reaches the host while other states in between are coalesced. The
+// next report is written from the in ready callback once the interface's IN endpoint is free.
+union usb_hid_report {
+    struct zmk_hid_boot_report boot;
+    struct zmk_hid_keypad_report keypad;
+    struct zmk_hid_consumer_report consumer;
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+    struct zmk_hid_pointer_report pointer;
+#endif
+};
+
+struct usb_hid_buffered_report {
+    size_t len;
+    union usb_hid_report report;
+};
+
+// Indexed by report ID. Boot protocol reports carry no ID and use slot 0.
+#define USB_HID_REPORT_SLOTS 4
+#define USB_HID_BOOT_SLOT 0
+#define USB_HID_KEYPAD_SLOT 1
+#define USB_HID_CONSUMER_SLOT 2
+#define USB_HID_POINTER_SLOT 3
+
+// Enough for a press, release and press of the same key within one poll interval.
+#define USB_HID_SLOT_DEPTH 4
+
+struct usb_hid_report_slot {
+    u8_t count;
+    struct usb_hid_buffered_report reports[USB_HID_SLOT_DEPTH];
+};
+
+struct usb_hid_interface {
+    const char *name;
+    struct device *dev;
+    struct usb_hid_buffered_report in_flight_report;
+    bool in_flight;
+    u8_t next_slot;
+    // Reports sent while the host is suspended, delivered in order once the bus resumes and
+    // ahead of any later report.
+    struct usb_hid_buffered_report wakeup_reports[CONFIG_ZMK_USB_WAKEUP_QUEUE_SIZE];
+    u8_t wakeup_head;
+    u8_t wakeup_count;
+};
+
+#if IS_ENABLED(CONFIG_ZMK_USB_HID_SPLIT_INTERFACES)
+#define USB_HID_INTERFACES 2
+#else
+#define USB_HID_INTERFACES 1
+#endif
+
+static struct usb_hid_interface interfaces[USB_HID_INTERFACES] = {
+    {.name = "HID_0"},
+#if IS_ENABLED(CONFIG_ZMK_USB_HID_SPLIT_INTERFACES)
+    {.name = "HID_1"},
+#endif
+};
+
+static struct k_spinlock report_lock;
+static struct usb_hid_report_slot report_slots[USB_HID_REPORT_SLOTS];
+
+// Time of the remote wakeup request that is still waiting for its first report to go out.
+static bool wakeup_pending;
+static u32_t wakeup_cycles;
+static struct zmk_usb_hid_wakeup_stats wakeup_stats;
+
+// Keyboard reports, boot or with report ID 1, use the first interface. With split interfaces,
+// all other reports use the second one, so they never wait behind keyboard reports.
+static struct usb_hid_interface *slot_interface(u8_t slot) {
+    return &interfaces[slot <= 1 ? 0 : USB_HID_INTERFACES - 1];
+}
+
+// Whether a bit is set in mid but in neither of the others, or the reverse. Skipping mid would
+// then hide a press and release, or a release and press, from the host.
+static bool bits_skippable(const u8_t *prev, const u8_t *mid, const u8_t *next, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if ((prev[i] ^ mid[i]) & (mid[i] ^ next[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool keys_contain(const u8_t *keys, size_t len, u8_t key) {
+    for (size_t i = 0; i < len; i++) {
+        if (keys[i] == key) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// The same check for reports listing the pressed usages in an array.
+static bool keys_skippable(const u8_t *prev, const u8_t *mid, const u8_t *next, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (mid[i] != 0 && !keys_contain(prev, len, mid[i]) && !keys_contain(next, len, mid[i])) {
+            return false;
+        }
+
+        if (prev[i] != 0 && !keys_contain(mid, len, prev[i]) && keys_contain(next, len, prev[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool consumer_contains(const struct zmk_hid_consumer_report_body *body, u16_t key) {
+    for (size_t i = 0; i < CONFIG_ZMK_HID_CONSUMER_REPORT_SIZE; i++) {
+        if (body->keys[i] == key) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool consumer_skippable(const struct zmk_hid_consumer_report_body *prev,
+                               const struct zmk_hid_consumer_report_body *mid,
+                               const struct zmk_hid_consumer_report_body *next) {
+    for (size_t i = 0; i < CONFIG_ZMK_HID_CONSUMER_REPORT_SIZE; i++) {
+        u16_t pressed = mid->keys[i];
+        u16_t released = prev->keys[i];
+
+        if (pressed != 0 && !consumer_contains(prev, pressed) &&
+            !consumer_contains(next, pressed)) {
+            return false;
+        }
+
+        if (released != 0 && !consumer_contains(mid, released) &&
+            consumer_contains(next, released)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Whether the host still sees every press and release if it gets prev and then next, without
+// the mid report in between.
+static bool report_skippable(u8_t slot, const union usb_hid_report *prev,
+                             const union usb_hid_report *mid, const union usb_hid_report *next) {
+    switch (slot) {
+    case USB_HID_BOOT_SLOT:
+        return bits_skippable(&prev->boot.modifiers, &mid->boot.modifiers, &next->boot.modifiers,
+                              sizeof(zmk_mod_flags)) &&
+               keys_skippable(prev->boot.keys, mid->boot.keys, next->boot.keys,
+                              ZMK_HID_BOOT_KEYS);
+    case USB_HID_KEYPAD_SLOT:
+#if IS_ENABLED(CONFIG_ZMK_HID_REPORT_TYPE_HKRO)
+        return bits_skippable(&prev->keypad.body.modifiers, &mid->keypad.body.modifiers,
+                              &next->keypad.body.modifiers, sizeof(zmk_mod_flags)) &&
+               keys_skippable(prev->keypad.body.keys, mid->keypad.body.keys,
+                              next->keypad.body.keys, ZMK_HID_BOOT_KEYS);
+#else
+        return bits_skippable((const u8_t *)&prev->keypad.body, (const u8_t *)&mid->keypad.body,
+                              (const u8_t *)&next->keypad.body,
+                              sizeof(struct zmk_hid_keypad_report_body));
+#endif
+    case USB_HID_CONSUMER_SLOT:
+        return consumer_skippable(&prev->consumer.body, &mid->consumer.body,
+                                  &next->consumer.body);
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+    case USB_HID_POINTER_SLOT:
+        return bits_skippable(&prev->pointer.body.buttons, &mid->pointer.body.buttons,
+                              &next->pointer.body.buttons, sizeof(u8_t));
+#endif
+    default:
+        return false;
+    }
+}
+
+// The oldest buffered report is never replaced, since the host may already be waiting for it.
+static void buffer_report(u8_t slot, const u8_t *report, size_t len) {
+    struct usb_hid_report_slot *s = &report_slots[slot];
+    struct usb_hid_buffered_report *buffered;
+    union usb_hid_report next;
+    bool replace;
+
+    memcpy(&next, report, len);
+    replace = s->count >= 2 && report_skippable(slot, &s->reports[s->count - 2].report,
+                                                &s->reports[s->count - 1].report, &next);
+
+    if (!replace && s->count == USB_HID_SLOT_DEPTH) {
+        LOG_WRN("Report ID %d buffer full, replacing the latest report", slot);
+        replace = true;
+    }
+
+    buffered = &s->reports[replace ? s->count - 1 : s->count++];
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+    struct zmk_hid_pointer_report_body replaced = buffered->report.pointer.body;
+#endif
+
+    buffered->len = len;
+    buffered->report = next;
+
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+    // Pointer reports carry relative motion, which has to move into the report replacing them.
+    if (replace && slot == USB_HID_POINTER_SLOT) {
+        zmk_hid_pointer_report_merge(&buffered->report.pointer.body, &replaced);
+    }
+#endif
+}
+
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+
+static bool is_pointer_report(const struct usb_hid_buffered_report *buffered) {
+    return hid_protocol == ZMK_HID_PROTOCOL_REPORT &&
+           buffered->report.pointer.report_id == USB_HID_POINTER_SLOT;
+}
+
+// Pointer motion is relative, so the motion of a dropped pointer report moves into the oldest
+// pointer report still queued, or back to the HID layer if there is none.
+static void keep_dropped_motion(struct usb_hid_interface *iface,
+                                const struct zmk_hid_pointer_report_body *motion) {
+    for (int i = 0; i < iface->wakeup_count; i++) {
+        struct usb_hid_buffered_report *queued =
+            &iface->wakeup_reports[(iface->wakeup_head + i) % CONFIG_ZMK_USB_WAKEUP_QUEUE_SIZE];
+
+        if (is_pointer_report(queued)) {
+            zmk_hid_pointer_report_merge(&queued->report.pointer.body, motion);
+            return;
+        }
+    }
+
+    zmk_hid_pointer_move(motion->x, motion->y, motion->wheel, motion->pan);
+}
+
+#endif /* IS_ENABLED(CONFIG_ZMK_HID_POINTER) */
+
+// When the queue is full the oldest report is dropped, like the endpoint queues do.
+static void queue_wakeup_report(struct usb_hid_interface *iface, const u8_t *report, size_t len) {
+    struct usb_hid_buffered_report *queued;
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+    struct usb_hid_buffered_report dropped = {.len = 0};
+#endif
+
+    if (iface->wakeup_count == CONFIG_ZMK_USB_WAKEUP_QUEUE_SIZE) {
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+        dropped = iface->wakeup_reports[iface->wakeup_head];
+#endif
+        iface->wakeup_head = (iface->wakeup_head + 1) % CONFIG_ZMK_USB_WAKEUP_QUEUE_SIZE;
+        iface->wakeup_count--;
+        wakeup_stats.dropped++;
+    }
+
+    queued = &iface->wakeup_reports[(iface->wakeup_head + iface->wakeup_count++) %
+                                    CONFIG_ZMK_USB_WAKEUP_QUEUE_SIZE];
+    queued->len = len;
+    memcpy(&queued->report, report, len);
+
+#if IS_ENABLED(CONFIG_ZMK_HID_POINTER)
+    if (dropped.len > 0 && is_pointer_report(&dropped)) {
+        keep_dropped_motion(iface, &dropped.report.pointer.body);
+    }
+#endif
+}
+
+// Picks the next buffered report for the interface, taking turns between report IDs, and marks
+// its IN endpoint busy with it.
+static bool take_next_report(struct usb_hid_interface *iface) {
+    k_spinlock_key_t key = k_spin_lock(&report_lock);
+    bool taken = false;
+
+    if (!iface->in_flight && iface->wakeup_count > 0) {
+        iface->in_flight_report = iface->wakeup_reports[iface->wakeup_head];
+        iface->wakeup_head = (iface->wakeup_head + 1) % CONFIG_ZMK_USB_WAKEUP_QUEUE_SIZE;
+        iface->wakeup_count--;
+        iface->in_flight = taken = true;
+    }
+
+    for (int i = 0; !iface->in_flight && i < USB_HID_REPORT_SLOTS; i++) {
+        u8_t slot = (iface->next_slot + i) % USB_HID_REPORT_SLOTS;
+        struct usb_hid_report_slot *s = &report_slots[slot];
+
+        if (s->count == 0 || slot_interface(slot) != iface) {
+            continue;
+        }
+
+        iface->in_flight_report = s->reports[0];
+        memmove(&s->reports[0], &s->reports[1], --s->count * sizeof(s->reports[0]));
+
+        iface->next_slot = (slot + 1) % USB_HID_REPORT_SLOTS;
+        iface->in_flight = taken = true;
+    }
+
+    k_spin_unlock(&report_lock, key);
+    return taken;
+}
+
+static void set_in_flight(struct usb_hid_interface *iface, bool value) {
+    k_spinlock_key_t key = k_spin_lock(&report_lock);
+
+    iface->in_flight = value;
+    k_spin_unlock(&report_lock, key);
+}
+
+static int write_next_report(struct usb_hid_interface *iface) {
+    if (!take_next_report(iface)) {
+        return 0;
+    }
+
+    int err = hid_int_ep_write(iface->dev, (u8_t *)&iface->in_flight_report.report,
+                               iface->in_flight_report.len, NULL);
+
+    if (err) {
+        LOG_ERR("Failed to write HID report on %s: %d", iface->name, err);
+        set_in_flight(iface, false);
+    }
 
-static void in_ready_cb(void) { k_sem_give(&hid_sem); }
+    return err;
+}
+
+// Drops the reports not handed to the USB stack yet. Transfers on the IN endpoints only end
+// with a bus reset or reconfiguration, otherwise the in ready callback still marks them done.
+static void clear_reports(bool end_transfers) {
+    k_spinlock_key_t key = k_spin_lock(&report_lock);
+
+    memset(report_slots, 0, sizeof(report_slots));
+    for (int i = 0; i < USB_HID_INTERFACES; i++) {
+        if (end_transfers) {
+            interfaces[i].in_flight = false;
+        }
+        interfaces[i].wakeup_count = 0;
+    }
+
+    wakeup_pending = false;
+    k_spin_unlock(&report_lock, key);
+}
+
+static void interface_ready(struct usb_hid_interface *iface) {
+    k_spinlock_key_t key = k_spin_lock(&report_lock);
+
+    iface->in_flight = false;
+
+    // The first completed transfer after a remote wakeup is the first report the host sees.
+    if (wakeup_pending) {
+        u32_t latency_us = k_cyc_to_us_floor32(k_cycle_get_32() - wakeup_cycles);
+
+        wakeup_pending = false;
+        wakeup_stats.last_latency_us = latency_us;
+        wakeup_stats.max_latency_us = MAX(wakeup_stats.max_latency_us, latency_us);
+        LOG_DBG("First report after wakeup delivered in %u us", latency_us);
+    }
+
+    k_spin_unlock(&report_lock, key);
+
+    write_next_report(iface);
+}
+
+static void in_ready_cb(void) { interface_ready(&interfaces[0]); }
+
+static void protocol_cb(u8_t protocol) {
+    LOG_DBG("Host selected %s protocol", protocol == ZMK_HID_PROTOCOL_BOOT ? "boot" : "report");
+    hid_protocol = protocol;
+    clear_reports(false);
+}
 
 static const struct hid_ops ops = {
     .int_in_ready = in_ready_cb,
+    .protocol_change = protocol_cb,
 };
 
-int zmk_usb_hid_send_report(const u8_t *report, size_t len) {
+#if IS_ENABLED(CONFIG_ZMK_USB_HID_SPLIT_INTERFACES)
+
+static void other_in_ready_cb(void) { interface_ready(&interfaces[1]); }
+
+// Only the keyboard interface follows the boot protocol.
+static const struct hid_ops other_ops = {
+    .int_in_ready = other_in_ready_cb,
+};
+
+// Length of the first top level collection of zmk_hid_report_desc, i.e. the keyboard, so both
+// interfaces are described by the same descriptor the single interface and HOG use.
+static size_t keyboard_report_desc_size() {
+    int depth = 0;
+    size_t i = 0;
+
+    while (i < sizeof(zmk_hid_report_desc)) {
+        u8_t item = zmk_hid_report_desc[i];
+        u8_t size = item & 0x03;
+
+        i += 1 + (size == 3 ? 4 : size);
+
+        if (item == HID_MI_COLLECTION) {
+            depth++;
+        } else if (item == HID_MI_COLLECTION_END && --depth == 0) {
+            return i;
+        }
+    }
+
+    return sizeof(zmk_hid_report_desc);
+}
+
+#endif /* IS_ENABLED(CONFIG_ZMK_USB_HID_SPLIT_INTERFACES) */
+
+u8_t zmk_usb_hid_get_protocol() { return hid_protocol; }
+
+// Whether a host has configured the device. A suspended host still counts, since it can be
+// woken up by the next report.
+bool zmk_usb_hid_is_ready() {
     switch (usb_status) {
-    case USB_DC_SUSPEND:
-        return usb_wakeup_request();
     case USB_DC_ERROR:
     case USB_DC_RESET:
+    case USB_DC_CONNECTED:
     case USB_DC_DISCONNECTED:
     case USB_DC_UNKNOWN:
-        return -ENODEV;
+        return false;
     default:
-        k_sem_take(&hid_sem, K_MSEC(30));
-        int err = hid_int_ep_write(hid_dev, report, len, NULL);
+        return true;
+    }
+}
+
+// Wakes up a suspended host and keeps the report until the bus resumes. If the host does not
+// allow remote wakeup, the report is dropped rather than delivered whenever it wakes up later.
+static int send_wakeup_report(u8_t slot, const u8_t *report, size_t len) {
+    k_spinlock_key_t key = k_spin_lock(&report_lock);
+    bool request = !wakeup_pending;
+
+    if (request) {
+        wakeup_pending = true;
+        wakeup_cycles = k_cycle_get_32();
+        wakeup_stats.wakeups++;
+    }
+
+    k_spin_unlock(&report_lock, key);
+
+    if (request) {
+        int err = usb_wakeup_request();
 
         if (err) {
-            k_sem_give(&hid_sem);
+            LOG_WRN("Remote wakeup failed: %d", err);
+            key = k_spin_lock(&report_lock);
+            wakeup_pending = false;
+            k_spin_unlock(&report_lock, key);
+            return err;
         }
+    }
+
+    key = k_spin_lock(&report_lock);
+    queue_wakeup_report(slot_interface(slot), report, len);
+    k_spin_unlock(&report_lock, key);
+
+    return 0;
+}
+
+int zmk_usb_hid_send_report(const u8_t *report, size_t len) {
+    u8_t slot = hid_protocol == ZMK_HID_PROTOCOL_BOOT ? 0 : report[0];
+    k_spinlock_key_t key;
+
+    if (slot >= USB_HID_REPORT_SLOTS || len > sizeof(union usb_hid_report)) {
+        return -EINVAL;
+    }
+
+    switch (usb_status) {
+    case USB_DC_SUSPEND:
+        return send_wakeup_report(slot, report, len);
+    case USB_DC_ERROR:
+    case USB_DC_RESET:
+    case USB_DC_DISCONNECTED:
+    case USB_DC_UNKNOWN:
+        return -ENODEV;
+    default:
+        key = k_spin_lock(&report_lock);
+        buffer_report(slot, report, len);
+        k_spin_unlock(&report_lock, key);
 
-        return err;
+        return write_next_report(slot_interface(slot));
     }
 }
 
-void usb_hid_status_cb(enum usb_dc_status_code status, const u8_t *params) { usb_status = status; };
+void zmk_usb_hid_get_wakeup_stats(struct zmk_usb_hid_wakeup_stats *stats) {
+    k_spinlock_key_t key = k_spin_lock(&report_lock);
+
+    *stats = wakeup_stats;
+    k_spin_unlock(&report_lock, key);
+}
+
+void usb_hid_status_cb(enum usb_dc_status_code status, const u8_t *params) {
+    bool was_ready = zmk_usb_hid_is_ready();
+    k_spinlock_key_t key;
+
+    // A bus reset returns the interface to report protocol.
+    if (status == USB_DC_RESET) {
+        hid_protocol = ZMK_HID_PROTOCOL_REPORT;
+    }
+
+    switch (status) {
+    case USB_DC_RESET:
+    case USB_DC_DISCONNECTED:
+    case USB_DC_CONFIGURED:
+        clear_reports(true);
+        break;
+    case USB_DC_SUSPEND:
+        // A new suspend needs a new wakeup request, even if the last one went unanswered.
+        key = k_spin_lock(&report_lock);
+        wakeup_pending = false;
+        k_spin_unlock(&report_lock, key);
+        break;
+    default:
+        break;
+    }
+
+    usb_status = status;
+
+    // Reports queued while the host was suspended go out now.
+    if (status == USB_DC_RESUME) {
+        for (int i = 0; i < USB_HID_INTERFACES; i++) {
+            write_next_report(&interfaces[i]);
+        }
+    }
+
+    if (zmk_usb_hid_is_ready() != was_ready) {
+        zmk_endpoints_transport_changed();
+    }
+};
 
 static int zmk_usb_hid_init(struct device *_arg) {
     int usb_enable_ret;
 
-    hid_dev = device_get_binding("HID_0");
-    if (hid_dev == NULL) {
-        LOG_ERR("Unable to locate HID device");
-        return -EINVAL;
+    for (int i = 0; i < USB_HID_INTERFACES; i++) {
+        interfaces[i].dev = device_get_binding(interfaces[i].name);
+        if (interfaces[i].dev == NULL) {
+            LOG_ERR("Unable to locate HID device %s", interfaces[i].name);
+            return -EINVAL;
+        }
     }
 
-    usb_hid_register_device(hid_dev, zmk_hid_report_desc, sizeof(zmk_hid_report_desc), &ops);
+#if IS_ENABLED(CONFIG_ZMK_USB_HID_SPLIT_INTERFACES)
+    size_t keyboard_size = keyboard_report_desc_size();
 
-    usb_hid_init(hid_dev);
+    usb_hid_register_device(interfaces[0].dev, zmk_hid_report_desc, keyboard_size, &ops);
+    usb_hid_register_device(interfaces[1].dev, zmk_hid_report_desc + keyboard_size,
+                            sizeof(zmk_hid_report_desc) - keyboard_size, &other_ops);
+#else
+    usb_hid_register_device(interfaces[0].dev, zmk_hid_report_desc, sizeof(zmk_hid_report_desc),
+                            &ops);
+#endif
+
+    for (int i = 0; i < USB_HID_INTERFACES; i++) {
+        usb_hid_init(interfaces[i].dev);
+    }
 
     usb_enable_ret = usb_enable(usb_hid_status_cb);
 
@@ -17,12 +17,14 @@ module.exports = {
     ],
     Behaviors: [
       "behavior/key-press",
+      "behavior/mouse-keys",
       "behavior/layers",
       "behavior/misc",
       "behavior/hold-tap",
       "behavior/mod-tap",
       "behavior/reset",
       "behavior/bluetooth",
+      "behavior/outputs",
       "behavior/lighting",
     ],
     Development: [